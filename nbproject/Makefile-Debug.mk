@@ -37,10 +37,13 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 OBJECTFILES= \
 	${OBJECTDIR}/src/ContentElement.o \
 	${OBJECTDIR}/src/Flow.o \
+	${OBJECTDIR}/src/FlowPool.o \
+	${OBJECTDIR}/src/FlowQueue.o \
 	${OBJECTDIR}/src/IPTVTopologyOracle.o \
 	${OBJECTDIR}/src/PLACeS.o \
 	${OBJECTDIR}/src/Scheduler.o \
 	${OBJECTDIR}/src/SimTimeInterval.o \
+	${OBJECTDIR}/src/SnapshotWriter.o \
 	${OBJECTDIR}/src/Topology.o \
 	${OBJECTDIR}/src/TopologyOracle.o \
 	${OBJECTDIR}/src/UGCPopularity.o \
@@ -61,7 +64,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=-L/usr/local/boost_1_58_0/stage/lib -L/home/dipascae/ibm/CPLEX_Studio126/concert/lib/x86-64_linux/static_pic -L/home/dipascae/ibm/CPLEX_Studio126/cplex/lib/x86-64_linux/static_pic -L/usr/local/boost_1_58_0/stage/lib -lboost_log_setup -lboost_log -lboost_program_options -lboost_date_time -lboost_filesystem -lboost_system -lboost_thread -lboost_graph -lcppunit -lilocplex -lcplex -lconcert -lcplexdistmip -lpthread `cppunit-config --libs` `cppunit-config --libs` -lboost_log  
+LDLIBSOPTIONS=-L/usr/local/boost_1_58_0/stage/lib -L/usr/local/boost_1_58_0/stage/lib -lboost_log_setup -lboost_log -lboost_program_options -lboost_date_time -lboost_filesystem -lboost_system -lboost_thread -lboost_graph -lcppunit -lpthread `cppunit-config --libs` `cppunit-config --libs` -lboost_log  
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -81,6 +84,16 @@ ${OBJECTDIR}/src/Flow.o: src/Flow.cpp
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -I/usr/local/boost_1_58_0 -I. -I/home/dipascae/ibm/CPLEX_Studio126/cplex/include -I/home/dipascae/ibm/CPLEX_Studio126/concert/include -I. -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/Flow.o src/Flow.cpp
 
+${OBJECTDIR}/src/FlowPool.o: src/FlowPool.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -I/usr/local/boost_1_58_0 -I. -I/home/dipascae/ibm/CPLEX_Studio126/cplex/include -I/home/dipascae/ibm/CPLEX_Studio126/concert/include -I. -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/FlowPool.o src/FlowPool.cpp
+
+${OBJECTDIR}/src/FlowQueue.o: src/FlowQueue.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -I/usr/local/boost_1_58_0 -I. -I/home/dipascae/ibm/CPLEX_Studio126/cplex/include -I/home/dipascae/ibm/CPLEX_Studio126/concert/include -I. -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/FlowQueue.o src/FlowQueue.cpp
+
 ${OBJECTDIR}/src/IPTVTopologyOracle.o: src/IPTVTopologyOracle.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} "$@.d"
@@ -101,6 +114,11 @@ ${OBJECTDIR}/src/SimTimeInterval.o: src/SimTimeInterval.cpp
 	${RM} "$@.d"
 	$(COMPILE.cc) -g -I/usr/local/boost_1_58_0 -I. -I/home/dipascae/ibm/CPLEX_Studio126/cplex/include -I/home/dipascae/ibm/CPLEX_Studio126/concert/include -I. -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/SimTimeInterval.o src/SimTimeInterval.cpp
 
+${OBJECTDIR}/src/SnapshotWriter.o: src/SnapshotWriter.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -I/usr/local/boost_1_58_0 -I. -I/home/dipascae/ibm/CPLEX_Studio126/cplex/include -I/home/dipascae/ibm/CPLEX_Studio126/concert/include -I. -std=c++11 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/SnapshotWriter.o src/SnapshotWriter.cpp
+
 ${OBJECTDIR}/src/Topology.o: src/Topology.cpp 
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} "$@.d"
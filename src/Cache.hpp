@@ -9,13 +9,17 @@
 #ifndef CACHE_HPP
 #define	CACHE_HPP
 
-#include <map>
+#include <unordered_map>
 #include <set>
 #include <assert.h>
 #include <iostream>
 #include <limits>
+#include "boost/intrusive/list.hpp"
 #include "RunningAvg.hpp"
 
+typedef boost::intrusive::list_member_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink> > CacheHook;
+
 /**
  * Policy to use in caches to replace old content and make space for new ones.
  */
@@ -24,38 +28,81 @@ enum CachePolicy {
   LFU  /**< Least-Frequently Used: delete the element with the lowest timesServed. */
 };
 
+template <typename Content, typename Timestamp, typename Size>
+struct FreqBucket;
+
 /**
  * Struct to hold the caching parameters associated to each content element;
  * Timestamp must be a scalar which supports std::numeric_limits<Timestamp>::max().
  * Size can be any scalar which supports comparison operators (e.g. <,>,>= etc.).
  */
-template <typename Timestamp, typename Size>
+template <typename Content, typename Timestamp, typename Size>
 struct CacheEntry {
   Timestamp lastAccessed; /**< Last time this item was accessed. Used with the LRU policy. */
   unsigned int timesServed; /**< Number of times this item was accessed. Used with the LFU policy. */
   Size size; /**< Size of the item, i.e., the amount of storage it occupies. */
   unsigned int uploads; /**< Number of current uploads of this item; used to calculate the bandwidth used and to ensure that we do not erase an element which is currently being pushed upstream. */
+  const Content* key; /**< The item this entry refers to, i.e., the key of the entry in the cache map. */
+  CacheHook recencyHook; /**< The hook linking this entry in the recency list of the Cache (LRU policy) or of its FreqBucket (LFU policy), from the least to the most recently used; unlinked while the entry is being uploaded. */
+  FreqBucket<Content, Timestamp, Size>* bucket; /**< The bucket of the entries served as many times as this one. Only used with the LFU policy. */
+};
+
+/**
+ * The entries of a Cache with the LFU policy which were served the same 
+ * number of times. Entries being uploaded are counted in numEntries, but they
+ * are only linked in the bucket when their uploads are over, so that the 
+ * first entry in the list can always be replaced.
+ */
+template <typename Content, typename Timestamp, typename Size>
+struct FreqBucket {
+  typedef CacheEntry<Content, Timestamp, Size> Entry;
+  typedef boost::intrusive::list<Entry, 
+          boost::intrusive::member_hook<Entry, CacheHook, &Entry::recencyHook>,
+          boost::intrusive::constant_time_size<false> > EntryList;
+  unsigned int freq; /**< The number of times the entries of this bucket were served. */
+  unsigned int numEntries; /**< The number of entries in this bucket, including those being uploaded. */
+  EntryList entries; /**< The entries of this bucket which are not being uploaded, from the least to the most recently used. */
+  CacheHook hook; /**< The hook linking this bucket in the bucket list of the Cache. */
 };
 
 /**
  * Implements a generic LRU or LFU cache, with a fixed maximum capacity maxSize
  * and elements of type Content which can be of variable size. Based on
- * std::map (not optimized for performance!). All methods but addToCache()
- * accept const references to a Content, since it is assumed that it will be
- * some sort of shared pointer.
+ * std::unordered_map; the entries are also linked in a recency list (LRU) or
+ * in frequency buckets (LFU, ties broken by recency) so that the item to 
+ * replace is found in constant time. Entries being uploaded cannot be replaced,
+ * hence they are only linked again when their uploads are over. All methods but addToCache() accept 
+ * const references to a Content, since it is assumed that it will be some 
+ * sort of shared pointer.
  */
 template <typename Content, typename Size, typename Timestamp> 
 class Cache {
+  typedef CacheEntry<Content, Timestamp, Size> Entry;
+  typedef FreqBucket<Content, Timestamp, Size> Bucket;
+  /**
+   * A std::unordered_map associating each item of the Cache with its metadata.
+   */
+  typedef std::unordered_map<Content, Entry> CacheMap;
   /**
-   * A std::map associating each item of the Cache with its metadata.
+   * An intrusive list of the entries of the Cache; entries unlink themselves
+   * when they are erased from the CacheMap.
    */
-  typedef std::map<Content, CacheEntry<Timestamp, Size> > CacheMap;
+  typedef typename Bucket::EntryList RecencyList;
+  /**
+   * An intrusive list of the frequency buckets of the Cache.
+   */
+  typedef boost::intrusive::list<Bucket, 
+          boost::intrusive::member_hook<Bucket, CacheHook, &Bucket::hook>,
+          boost::intrusive::constant_time_size<false> > BucketList;
 protected:
   CacheMap cacheMap; /**< The content of the cache, i.e., the set of items cached together with their caching metadata. */
+  RecencyList recencyList; /**< With the LRU policy, the entries of cacheMap which are not being uploaded, sorted from the least to the most recently used. */
+  BucketList freqBuckets; /**< With the LFU policy, the non-empty buckets of entries served the same number of times, by increasing frequency. */
   Size maxSize; /**< The maximum storage space available on this Cache. */
   Size currentSize; /**< The current storage occupancy of this Cache. */
   CachePolicy policy; /**< The replacement policy used to make space for a new item when the Cache is full. */
   RunningAvg<double, Timestamp> cacheOccupancy; /**< A tracker of the time-weighted average occupancy of the cache. */
+  unsigned long version; /**< Incremented whenever an item is added or removed, or the number of uploads of an item changes. */
   /**
    * Updates the average Cache occupancy after a modification to the storage
    * (i.e., an element was erased or added).
@@ -80,6 +127,22 @@ public:
    * @param policy The replacement policy to be used when the Cache is full and a new element must be inserted.
    */
   Cache(Size maxSize, CachePolicy policy = LRU);
+  /**
+   * Copy constructor; the recency list cannot be copied, so it is rebuilt 
+   * over the entries of the new Cache.
+   * @param other The Cache to be copied.
+   */
+  Cache(const Cache& other);
+  /**
+   * Assignment operator; the recency list is rebuilt as in the copy constructor.
+   * @param other The Cache to be copied.
+   * @return A reference to this Cache.
+   */
+  Cache& operator=(const Cache& other);
+  /**
+   * Destructor; frees the frequency buckets.
+   */
+  ~Cache();
   /**
    * Attempt to insert a new item in the Cache.
    * @param content The item that we want to add to the Cache.
@@ -131,6 +194,49 @@ public:
    * @return The total number of concurrent uploads for all the elements in the Cache.
    */
   int getTotalUploads() const;
+  /**
+   * Retrieves the version of the content of the Cache, which changes whenever
+   * items are added or removed or their uploads change (but not on local 
+   * accesses). Can be used to detect that the Cache was not modified since 
+   * a previous call.
+   * @return The current version of the Cache.
+   */
+  unsigned long getVersion() const {
+    return this->version;
+  }
+  
+private:
+  /**
+   * Points the entries of cacheMap to their keys and links them in the 
+   * recency list in the same order as the entries of another Cache, after 
+   * cacheMap was copied from the latter.
+   * @param other The Cache cacheMap was copied from.
+   */
+  void relinkEntries(const Cache& other);
+  /**
+   * Frees all the frequency buckets, unlinking their entries.
+   */
+  void clearBuckets();
+  /**
+   * Retrieves the bucket for a given frequency, creating it if needed. 
+   * @param freq The frequency of the bucket.
+   * @param prev A bucket with a lower frequency to start the search from, or
+   * nullptr to start from the least frequent bucket.
+   * @return The bucket with frequency freq.
+   */
+  Bucket* getBucket(unsigned int freq, Bucket* prev);
+  /**
+   * Removes an entry from its bucket, freeing the latter if it is left empty.
+   * @param entry The entry which is leaving its bucket.
+   */
+  void leaveBucket(Entry& entry);
+  /**
+   * Erases an entry from the Cache, updating its size but not its occupancy.
+   * @param it The entry to be erased.
+   */
+  void eraseEntry(typename CacheMap::iterator it);
+  
+public:
   /**
    * Retrieve the average cache occupancy as calculated at the specified Timestamp.
    * @param time The Timestamp at which we want to know the average occupancy.
@@ -156,7 +262,7 @@ public:
    * the storage space optimization of TopologyOracle::optimizeCaching().  
    * @return The full content of the Cache with the related metadata information.
    */
-  CacheMap getCacheMap() const {
+  const CacheMap& getCacheMap() const {
     return this->cacheMap;
   }
   
@@ -204,6 +310,115 @@ Cache<Content, Size, Timestamp>::Cache(Size maxSize, CachePolicy policy) : cache
   this->maxSize = maxSize;
   this->policy = policy;
   this->currentSize = 0;
+  this->version = 0;
+}
+
+template <typename Content, typename Size, typename Timestamp>
+Cache<Content, Size, Timestamp>::Cache(const Cache& other) : 
+        cacheMap(other.cacheMap), cacheOccupancy(other.cacheOccupancy) {
+  this->maxSize = other.maxSize;
+  this->policy = other.policy;
+  this->currentSize = other.currentSize;
+  this->version = other.version;
+  relinkEntries(other);
+}
+
+template <typename Content, typename Size, typename Timestamp>
+Cache<Content, Size, Timestamp>& Cache<Content, Size, Timestamp>::operator=(
+        const Cache& other) {
+  if (this != &other) {
+    recencyList.clear();
+    clearBuckets();
+    cacheMap = other.cacheMap;
+    maxSize = other.maxSize;
+    policy = other.policy;
+    currentSize = other.currentSize;
+    cacheOccupancy = other.cacheOccupancy;
+    version = other.version;
+    relinkEntries(other);
+  }
+  return *this;
+}
+
+template <typename Content, typename Size, typename Timestamp>
+Cache<Content, Size, Timestamp>::~Cache() {
+  clearBuckets();
+}
+
+template <typename Content, typename Size, typename Timestamp>
+void Cache<Content, Size, Timestamp>::relinkEntries(const Cache& other) {
+  for (typename CacheMap::iterator it = cacheMap.begin(); it != cacheMap.end(); it++)
+    it->second.key = &(it->first);
+  for (typename RecencyList::const_iterator it = other.recencyList.begin(); 
+          it != other.recencyList.end(); it++)
+    recencyList.push_back(cacheMap.at(*(it->key)));
+  // copy the buckets, then move the entries to the copies
+  std::unordered_map<const Bucket*, Bucket*> copies;
+  for (typename BucketList::const_iterator bIt = other.freqBuckets.begin();
+          bIt != other.freqBuckets.end(); bIt++) {
+    Bucket* bucket = new Bucket();
+    bucket->freq = bIt->freq;
+    bucket->numEntries = bIt->numEntries;
+    freqBuckets.push_back(*bucket);
+    copies[&(*bIt)] = bucket;
+    for (typename RecencyList::const_iterator it = bIt->entries.begin(); 
+            it != bIt->entries.end(); it++)
+      bucket->entries.push_back(cacheMap.at(*(it->key)));
+  }
+  if (!copies.empty()) {
+    for (typename CacheMap::iterator it = cacheMap.begin(); it != cacheMap.end(); it++)
+      it->second.bucket = copies.at(it->second.bucket);
+  }
+}
+
+template <typename Content, typename Size, typename Timestamp>
+void Cache<Content, Size, Timestamp>::clearBuckets() {
+  while (!freqBuckets.empty()) {
+    Bucket* bucket = &freqBuckets.front();
+    bucket->entries.clear();
+    // the bucket unlinks itself from freqBuckets
+    delete bucket;
+  }
+}
+
+template <typename Content, typename Size, typename Timestamp>
+typename Cache<Content, Size, Timestamp>::Bucket* 
+Cache<Content, Size, Timestamp>::getBucket(unsigned int freq, Bucket* prev) {
+  typename BucketList::iterator it = (prev == nullptr) ? freqBuckets.begin() 
+          : freqBuckets.iterator_to(*prev);
+  // frequencies only grow by one, so this is usually the next bucket
+  while (it != freqBuckets.end() && it->freq < freq)
+    it++;
+  if (it != freqBuckets.end() && it->freq == freq)
+    return &(*it);
+  Bucket* bucket = new Bucket();
+  bucket->freq = freq;
+  bucket->numEntries = 0;
+  freqBuckets.insert(it, *bucket);
+  return bucket;
+}
+
+template <typename Content, typename Size, typename Timestamp>
+void Cache<Content, Size, Timestamp>::leaveBucket(Entry& entry) {
+  Bucket* bucket = entry.bucket;
+  if (entry.recencyHook.is_linked())
+    entry.recencyHook.unlink();
+  entry.bucket = nullptr;
+  bucket->numEntries--;
+  if (bucket->numEntries == 0) {
+    assert(bucket->entries.empty());
+    delete bucket;
+  }
+}
+
+template <typename Content, typename Size, typename Timestamp>
+void Cache<Content, Size, Timestamp>::eraseEntry(typename CacheMap::iterator it) {
+  if (policy == LFU)
+    leaveBucket(it->second);
+  currentSize -= it->second.size;
+  // the entry unlinks itself from the recency list
+  cacheMap.erase(it);
+  version++;
 }
 
 template <typename Content, typename Size, typename Timestamp>
@@ -220,39 +435,37 @@ std::pair<bool, std::set<Content> > Cache<Content, Size, Timestamp>::addToCache(
   }  
   else {
     unsigned int oldFreqStat = 0;
-    if (cIt!= cacheMap.end()) {
+    if (cIt != cacheMap.end()) {
       // the content was cached, but with a smaller chunk, delete it (but save
       // the caching info - after all it's the same content)
-      this->currentSize -= cIt->second.size;
       oldFreqStat = cIt->second.timesServed;
       /* FIXME: if something goes wrong and we cannot cache the new element,
        * we will lose the previous (partial) copy
        */
-      this->cacheMap.erase(cIt);
+      eraseEntry(cIt);
     }
     while (currentSize + size > maxSize) {
       // Replace content according to selected policy
-      Timestamp minTmp = std::numeric_limits<Timestamp>::max();
       typename CacheMap::iterator minIt = cacheMap.end();
       switch (policy) {
-        case LRU:          
-          for (typename CacheMap::iterator it = cacheMap.begin();
-                  it != cacheMap.end(); it++) {
-            if (it->second.uploads == 0 && it->second.lastAccessed < minTmp) {
-              minTmp = it->second.lastAccessed;
-              minIt = it;
-            }              
-          }
+        case LRU: {
+          // entries being uploaded are not linked, so the first one can go
+          if (!recencyList.empty())
+            minIt = cacheMap.find(*(recencyList.front().key));
           break;
-        case LFU:
-          for (typename CacheMap::iterator it = cacheMap.begin();
-                  it != cacheMap.end(); it++) {
-            if (it->second.uploads == 0 && it->second.timesServed < minTmp) {
-              minTmp = it->second.timesServed;
-              minIt = it;
-            }              
-          }
+        }
+        case LFU: {
+          /* the least recently used entry of the least frequent bucket; entries
+           * being uploaded are not linked, so only buckets holding nothing but
+           * such entries are skipped
+           */
+          typename BucketList::iterator bIt = freqBuckets.begin();
+          while (bIt != freqBuckets.end() && bIt->entries.empty())
+            bIt++;
+          if (bIt != freqBuckets.end())
+            minIt = cacheMap.find(*(bIt->entries.front().key));
           break;
+        }
         default:
           std::cerr << "ERROR: Cache::addToCache - unrecognized CachePolicy"
                   << std::endl;
@@ -263,18 +476,30 @@ std::pair<bool, std::set<Content> > Cache<Content, Size, Timestamp>::addToCache(
         return std::make_pair(false, deletedElements);
       }
       // else remove the identified element from the cache
-      currentSize -= minIt->second.size;
       deletedElements.insert(minIt->first);
-      cacheMap.erase(minIt);
+      eraseEntry(minIt);
     }
     // insert new element in the cache
-    CacheEntry<Timestamp, Size> entry;
+    Entry entry;
     entry.lastAccessed = time;
     entry.timesServed = oldFreqStat; // 0 if the content is new
     entry.size = size;
     entry.uploads = 0;
-    if (cacheMap.insert(std::make_pair(content,entry)).second == true) {
+    std::pair<typename CacheMap::iterator, bool> insResult = 
+            cacheMap.insert(std::make_pair(content,entry));
+    if (insResult.second == true) {
+      Entry& newEntry = insResult.first->second;
+      newEntry.key = &(insResult.first->first);
+      newEntry.bucket = nullptr;
+      if (policy == LRU)
+        recencyList.push_back(newEntry);
+      else if (policy == LFU) {
+        newEntry.bucket = getBucket(newEntry.timesServed, nullptr);
+        newEntry.bucket->numEntries++;
+        newEntry.bucket->entries.push_back(newEntry);
+      }
       currentSize += size;
+      version++;
       assert(currentSize <= maxSize);
       updateOccupancy(time);
       return std::make_pair(true, deletedElements);
@@ -289,8 +514,11 @@ std::pair<bool, std::set<Content> > Cache<Content, Size, Timestamp>::addToCache(
 
 template <typename Content, typename Size, typename Timestamp>
 void Cache<Content, Size, Timestamp>::clearCache() {
+  recencyList.clear();
+  clearBuckets();
   cacheMap.clear();
   this->currentSize = 0;
+  version++;
   cacheOccupancy.reset(0,0);
 }
 
@@ -301,8 +529,26 @@ bool Cache<Content, Size, Timestamp>::getFromCache(const Content& content,
   if (it != cacheMap.end()) {
     it->second.lastAccessed = time;
     it->second.timesServed++;
-    if (!local)
+    if (!local) {
       it->second.uploads++;
+      version++;
+    }
+    Entry& entry = it->second;
+    if (policy == LRU) {
+      // move the entry to the most recently used end of the list, unless it is being uploaded
+      if (entry.recencyHook.is_linked())
+        entry.recencyHook.unlink();
+      if (entry.uploads == 0)
+        recencyList.push_back(entry);
+    } else if (policy == LFU) {
+      // move the entry to the next bucket, unless it is being uploaded
+      Bucket* bucket = getBucket(entry.timesServed, entry.bucket);
+      leaveBucket(entry);
+      entry.bucket = bucket;
+      bucket->numEntries++;
+      if (entry.uploads == 0)
+        bucket->entries.push_back(entry);
+    }
     return true;
   } 
   else
@@ -321,11 +567,10 @@ bool Cache<Content, Size, Timestamp>::isCached(const Content& content) const {
 template <typename Content, typename Size, typename Timestamp>
 void Cache<Content, Size, Timestamp>::removeFromCache(const Content& content, 
         const Timestamp time) {
-  typename CacheMap::const_iterator it = cacheMap.find(content);
+  typename CacheMap::iterator it = cacheMap.find(content);
   if (it != cacheMap.end()) {
-    this->currentSize -= it->second.size;
+    eraseEntry(it);
     assert(this->currentSize >= 0);
-    cacheMap.erase(it);
     updateOccupancy(time);
   }
 }
@@ -336,6 +581,14 @@ bool Cache<Content, Size, Timestamp>::uploadCompleted(const Content& content) {
   if (it != cacheMap.end()) {
     it->second.uploads = it->second.uploads - 1;
     assert(it->second.uploads >= 0);
+    version++;
+    // the entry can be replaced again, as if it had just been used
+    if (it->second.uploads == 0) {
+      if (policy == LRU)
+        recencyList.push_back(it->second);
+      else if (policy == LFU)
+        it->second.bucket->entries.push_back(it->second);
+    }
     return true;
   } else {
     return false;
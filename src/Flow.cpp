@@ -15,6 +15,10 @@ Flow::Flow(ContentElement* content, PonUser destination, SimTime eta,
   this->P2PFlow = true;
   this->flowType = flowType;
   this->chunkId = chunkId;
+  this->queueKey = eta;
+  this->edgeLinks = nullptr;
+  this->fairShareStamp = 0;
+  this->fairShareSlot = 0;
 }
 
 Flow::~Flow() {
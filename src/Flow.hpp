@@ -10,11 +10,17 @@
 
 #include "ContentElement.hpp"
 #include "PLACeS.hpp"
+#include "Topology.hpp"
+#include "boost/intrusive/list_hook.hpp"
+
+typedef boost::intrusive::list_member_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink> > QueueHook;
 
 /** Enum to define the kind of event:
  * REQUEST: Transfer yet to be initiated, has to get a source assigned
  * TRANSFER: Actual data transfer between a source and a destination
  * SNAPSHOT: take a snapshot of the network status and export it as graphml
+ * OPTIMIZE: optimize the storage utilization of all the user caches
  * TERMINATE: end the current round
  * WATCH: update the current watching position in the stream, for chunking
  */
@@ -22,6 +28,7 @@ enum class FlowType {
   REQUEST,
   TRANSFER,
   SNAPSHOT,
+  OPTIMIZE,
   TERMINATE,
   WATCH
 };
@@ -32,8 +39,10 @@ class Flow {
 protected:
   PonUser source; /**< The source of the data flow, i.e., the network element pushing the content item to the destination. */
   PonUser destination; /**< The destination of the data flow, i.e., the requester of the content item. */
+  Route route; /**< The route from source to destination, resolved once when the source is assigned so that bandwidth updates do not need to look it up again. Set through Scheduler::setRoute(). */
+  EdgeLink* edgeLinks; /**< The links of this Flow in the lists of active Flows of the Edges of its route, one per position in the route. Allocated by the FlowPool together with the route, nullptr for the Flows without a route. */
   SimTime start; /**< The SimTime at which this flow started. */
-  SimTime eta; /**< The SimTime at which this flow is estimated to be finishing. Can change depending on the available bandwdidth over this particular flow's route. It's used by the Scheduler to sort Flows in the PriorityQueue. */
+  SimTime eta; /**< The SimTime at which this flow is estimated to be finishing. Can change depending on the available bandwdidth over this particular flow's route. It's used by the Scheduler to sort Flows in the FlowQueue. */
   ContentElement* content; /**< The content item requested by the destination. */
   uint chunkId; /**< The identifier of the chunk of the content item being transmitted or requested. */
   Capacity bandwidth; /**< The bandwidth currently assigned to this flow, as determined by the Topology class. */
@@ -41,6 +50,16 @@ protected:
   Capacity sizeDownloaded; /**< The amount of data that has been downloaded at SimTime lastUpdate. */
   bool P2PFlow; /**< True if this is a peer-to-peer flow, i.e., both source and destination are PonUsers. False otherwise.*/
   FlowType flowType; /**< The type of this Flow, as described in the FlowType enum. */
+  QueueHook queueHook; /**< The hook linking this Flow in the event queue of the Scheduler, while it is scheduled. */
+  SimTime queueKey; /**< The time used by the FlowQueue to select the bucket of this Flow; it is the ETA, unless the latter was in the past when the Flow was scheduled. */
+  QueueHook roundHook; /**< The hook linking this Flow in the list of the Scheduler of the Flows that will have to be dropped at the end of a round, if any. */
+  uint64_t fairShareStamp; /**< The max-min fair reallocation of the Topology that last visited this Flow; fairShareSlot is only meaningful if it is the current one. */
+  uint fairShareSlot; /**< The slot of this Flow in the last max-min fair reallocation that visited it. */
+
+  friend class FlowQueue;
+  friend class Scheduler;
+  friend class FlowPool;
+  friend class Topology;
 
 public:
   /** Class constructor.
@@ -115,6 +134,20 @@ public:
     this->source = source;
   }
 
+  const Route& getRoute() const {
+    return route;
+  }
+
+  /**
+   * Retrieves the link of this Flow in the list of active Flows of one of the
+   * Edges of its route.
+   * @param pos The position of the Edge in the route of this Flow.
+   * @return The EdgeLink for the specified position.
+   */
+  EdgeLink& getEdgeLink(uint pos) {
+    return edgeLinks[pos];
+  }
+
   SimTime getStart() const {
     return start;
   }
@@ -154,6 +187,14 @@ public:
     return chunkId;
   }
 
+  /**
+   * Checks whether this Flow is currently in the event queue of the Scheduler.
+   * @return True if the Flow is scheduled, False otherwise.
+   */
+  bool isScheduled() const {
+    return queueHook.is_linked();
+  }
+
   /**
    * Utility method to simply retrieve the Size of the chunk being requested/transmitted
    * through this Flow.
@@ -166,22 +207,5 @@ public:
   
 };
 
-/** This function is what is used by the PriorityQueue in the Scheduler to sort
- *  Flows in ascending order of eta. The only catch is that Flows of type 
- *  FlowType::TERMINATE should always be put further down the queue compared
- *  with other types of event with the same eta.
- */
-struct CompareFlowPtr : public std::binary_function < Flow*, Flow*, bool> {
-  bool operator()(Flow* x, Flow * y) const {
-    if (x->getSimTime() == y->getSimTime()) {
-      if (x->getFlowType() == FlowType::TERMINATE)
-        return true;
-      else if (y->getFlowType() == FlowType::TERMINATE)
-        return false;
-    }
-    return x->getSimTime() > y->getSimTime();
-  }
-};
-
 #endif	/* FLOW_HPP */
 
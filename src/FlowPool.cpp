@@ -0,0 +1,111 @@
+#include "FlowPool.hpp"
+#include "boost/foreach.hpp"
+#include <algorithm>
+
+const size_t FlowPool::SLAB_SIZE;
+const size_t FlowPool::LINK_SLAB_SIZE;
+
+FlowPool::FlowPool() {
+  this->freeList = nullptr;
+  this->liveFlows = 0;
+  this->linkSlabUsed = LINK_SLAB_SIZE;
+}
+
+FlowPool::~FlowPool() {
+  BOOST_FOREACH (Slot* slab, slabs) {
+    delete[] slab;
+  }
+  slabs.clear();
+  BOOST_FOREACH (LinkSlot* slab, linkSlabs) {
+    delete[] slab;
+  }
+  linkSlabs.clear();
+}
+
+void FlowPool::grow() {
+  Slot* slab = new Slot[SLAB_SIZE];
+  slabs.push_back(slab);
+  // link the slots backwards, so that they are handed out in order of address
+  for (size_t i = SLAB_SIZE; i > 0; i--) {
+    slab[i-1].next = freeList;
+    freeList = &slab[i-1];
+  }
+}
+
+void FlowPool::trim() {
+  if (slabs.empty())
+    return;
+  std::sort(slabs.begin(), slabs.end());
+  std::vector<size_t> freeSlots(slabs.size(), 0);
+  std::vector<size_t> slabIndex;
+  for (Slot* slot = freeList; slot != nullptr; slot = slot->next) {
+    size_t index = std::upper_bound(slabs.begin(), slabs.end(), slot) - slabs.begin() - 1;
+    slabIndex.push_back(index);
+    freeSlots[index]++;
+  }
+  // rebuild the free list without the slots of the slabs being released
+  Slot* slot = freeList;
+  freeList = nullptr;
+  BOOST_FOREACH (size_t index, slabIndex) {
+    Slot* next = slot->next;
+    if (freeSlots[index] < SLAB_SIZE) {
+      slot->next = freeList;
+      freeList = slot;
+    }
+    slot = next;
+  }
+  std::vector<Slot*> usedSlabs;
+  for (size_t i = 0; i < slabs.size(); i++) {
+    if (freeSlots[i] == SLAB_SIZE)
+      delete[] slabs[i];
+    else
+      usedSlabs.push_back(slabs[i]);
+  }
+  slabs.swap(usedSlabs);
+}
+
+void FlowPool::setRoute(Flow* flow, const Route& route) {
+  uint oldLength = flow->edgeLinks != nullptr ? flow->route.size() : 0;
+  flow->route = route;
+  if (oldLength == route.size())
+    return;
+  if (oldLength > 0)
+    this->releaseLinks(flow->edgeLinks, oldLength);
+  flow->edgeLinks = nullptr;
+  if (route.empty())
+    return;
+  flow->edgeLinks = this->allocateLinks(route.size());
+  for (uint i = 0; i < route.size(); i++)
+    flow->edgeLinks[i].flow = flow;
+}
+
+EdgeLink* FlowPool::allocateLinks(uint numLinks) {
+  LinkSlot* slots;
+  if (numLinks < freeLinks.size() && !freeLinks[numLinks].empty()) {
+    slots = reinterpret_cast<LinkSlot*> (freeLinks[numLinks].back());
+    freeLinks[numLinks].pop_back();
+  } else if (numLinks > LINK_SLAB_SIZE) {
+    // a route longer than a whole slab gets a slab of its own, which is kept
+    // before the last slab as the latter is the one being carved
+    slots = new LinkSlot[numLinks];
+    linkSlabs.insert(linkSlabs.end() - (linkSlabs.empty() ? 0 : 1), slots);
+  } else {
+    if (linkSlabUsed + numLinks > LINK_SLAB_SIZE) {
+      linkSlabs.push_back(new LinkSlot[LINK_SLAB_SIZE]);
+      linkSlabUsed = 0;
+    }
+    slots = linkSlabs.back() + linkSlabUsed;
+    linkSlabUsed += numLinks;
+  }
+  for (uint i = 0; i < numLinks; i++)
+    new (&slots[i]) EdgeLink();
+  return reinterpret_cast<EdgeLink*> (slots);
+}
+
+void FlowPool::releaseLinks(EdgeLink* links, uint numLinks) {
+  for (uint i = 0; i < numLinks; i++)
+    links[i].~EdgeLink();
+  if (numLinks >= freeLinks.size())
+    freeLinks.resize(numLinks + 1);
+  freeLinks[numLinks].push_back(links);
+}
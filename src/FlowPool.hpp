@@ -0,0 +1,129 @@
+/*
+ * File:   FlowPool.hpp
+ * Author: emanuele
+ *
+ * Created on 16 October 2026, 15:40
+ */
+
+#ifndef FLOWPOOL_HPP
+#define	FLOWPOOL_HPP
+
+#include "Flow.hpp"
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * An arena for the Flow objects of a simulation.
+ *
+ * Flows are allocated from slabs of FlowPool::SLAB_SIZE elements, and the slots
+ * of the Flows which have been destroyed are kept in a free list and recycled
+ * by the following allocations, so that creating and destroying a Flow does not
+ * go through the heap in the common case. The slabs which do not contain any
+ * live Flow can be returned to the system with trim(), and all the slabs are
+ * released at once when the pool is destroyed. The Flows still alive at that 
+ * point are not destroyed: their destructors are not run and their hooks are 
+ * not unlinked, so they must be released with destroy() (or at least removed 
+ * from any intrusive list) before the pool goes away.
+ */
+class FlowPool {
+public:
+  static const size_t SLAB_SIZE = 4096; /**< The number of Flows in each slab. */
+  static const size_t LINK_SLAB_SIZE = 16384; /**< The number of EdgeLinks in each slab of EdgeLinks. */
+
+protected:
+  /**
+   * A slot of a slab, which either holds a Flow or the link to the next free slot.
+   */
+  union Slot {
+    Slot* next;
+    std::aligned_storage<sizeof(Flow), alignof(Flow)>::type storage;
+  };
+
+  std::vector<Slot*> slabs; /**< The slabs allocated so far. */
+  Slot* freeList; /**< The first free slot, or nullptr if all the slots are in use. */
+  size_t liveFlows; /**< The number of Flows currently allocated from the pool. */
+  typedef std::aligned_storage<sizeof(EdgeLink), alignof(EdgeLink)>::type LinkSlot; /**< The storage of one EdgeLink. */
+  std::vector<LinkSlot*> linkSlabs; /**< The slabs from which the arrays of EdgeLinks are carved, in order of allocation. */
+  size_t linkSlabUsed; /**< The number of EdgeLinks already carved from the last slab of linkSlabs. */
+  std::vector<std::vector<EdgeLink*> > freeLinks; /**< For each route length, the arrays of EdgeLinks of that length released by previous Flows, to be recycled. */
+
+  /**
+   * Allocates a new slab and adds all of its slots to the free list.
+   */
+  void grow();
+  /**
+   * Provides an array of EdgeLinks, recycling one released by a previous Flow
+   * if possible, otherwise carving it from the slabs of EdgeLinks.
+   * @param numLinks The number of EdgeLinks in the array, at least 1.
+   * @return The first EdgeLink of the array.
+   */
+  EdgeLink* allocateLinks(uint numLinks);
+  /**
+   * Returns an array of EdgeLinks to the pool, for a later Flow with a route of
+   * the same length.
+   * @param links The array of EdgeLinks.
+   * @param numLinks The number of EdgeLinks in the array.
+   */
+  void releaseLinks(EdgeLink* links, uint numLinks);
+  
+public:
+  FlowPool();
+  ~FlowPool();
+
+  /**
+   * Constructs a new Flow in a free slot of the pool.
+   * @param args The arguments for the constructor of Flow.
+   * @return A pointer to the new Flow, to be released with destroy().
+   */
+  template <typename... Args>
+  Flow* create(Args&&... args) {
+    if (freeList == nullptr)
+      this->grow();
+    Slot* slot = freeList;
+    freeList = slot->next;
+    liveFlows++;
+    return new (&slot->storage) Flow(std::forward<Args>(args)...);
+  }
+
+  /**
+   * Destroys a Flow created by this pool and makes its slot available again.
+   * @param flow The Flow to be destroyed.
+   */
+  void destroy(Flow* flow) {
+    if (flow->edgeLinks != nullptr)
+      this->releaseLinks(flow->edgeLinks, flow->route.size());
+    flow->~Flow();
+    Slot* slot = reinterpret_cast<Slot*> (flow);
+    slot->next = freeList;
+    freeList = slot;
+    liveFlows--;
+  }
+
+  /**
+   * Sets the route of a Flow, and provides it with one EdgeLink for each Edge
+   * of the route so that it can be linked to their lists of active Flows. The
+   * Flow must not be linked to the Edges of its previous route, if any.
+   * @param flow A Flow created by this pool.
+   * @param route The new route of the Flow.
+   */
+  void setRoute(Flow* flow, const Route& route);
+
+  /**
+   * Releases the slabs which do not contain any live Flow. The slabs of 
+   * EdgeLinks are kept, as their size is bounded by the highest number of 
+   * Flows with a route at any given time, and released with the pool.
+   */
+  void trim();
+
+  size_t size() const {
+    return liveFlows;
+  }
+
+  size_t capacity() const {
+    return slabs.size() * SLAB_SIZE;
+  }
+};
+
+#endif	/* FLOWPOOL_HPP */
+
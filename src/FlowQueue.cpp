@@ -0,0 +1,133 @@
+#include "FlowQueue.hpp"
+#include "boost/foreach.hpp"
+#include <algorithm>
+
+const uint FlowQueue::WHEEL_BITS;
+const SimTime FlowQueue::WHEEL_SIZE;
+const SimTime FlowQueue::RING_SIZE;
+
+FlowQueue::FlowQueue() : wheel(WHEEL_SIZE), ring(RING_SIZE) {
+  this->cursor = 0;
+  this->epoch = 0;
+  this->overflowMin = INF_TIME;
+  this->wheelCount = 0;
+  this->count = 0;
+}
+
+FlowQueue::~FlowQueue() {
+  this->clear();
+}
+
+void FlowQueue::place(Flow* flow) {
+  SimTime flowEpoch = flow->queueKey >> WHEEL_BITS;
+  if (flowEpoch == this->epoch) {
+    FlowBucket& bucket = wheel[flow->queueKey & (WHEEL_SIZE - 1)];
+    FlowBucket::iterator pos = bucket.end();
+    // termination events must come after anything else with the same eta
+    if (flow->getFlowType() != FlowType::TERMINATE) {
+      while (pos != bucket.begin()
+              && std::prev(pos)->getFlowType() == FlowType::TERMINATE)
+        --pos;
+    }
+    bucket.insert(pos, *flow);
+    wheelCount++;
+  } else if (flowEpoch < this->epoch + RING_SIZE) {
+    ring[flowEpoch & (RING_SIZE - 1)].push_back(*flow);
+  } else {
+    overflow.push_back(*flow);
+    overflowMin = std::min(overflowMin, flow->queueKey);
+  }
+}
+
+void FlowQueue::unplace(Flow* flow) {
+  if ((flow->queueKey >> WHEEL_BITS) == this->epoch)
+    wheelCount--;
+  flow->queueHook.unlink();
+}
+
+void FlowQueue::nextEpoch() {
+  SimTime next = this->epoch + RING_SIZE;
+  for (SimTime e = this->epoch + 1; e < this->epoch + RING_SIZE; e++) {
+    if (!ring[e & (RING_SIZE - 1)].empty()) {
+      next = e;
+      break;
+    }
+  }
+  if (next == this->epoch + RING_SIZE)
+    next = std::max(next, overflowMin >> WHEEL_BITS);
+  this->epoch = next;
+  this->cursor = next << WHEEL_BITS;
+  // bring the overflow events that are now within range of the ring down
+  FlowBucket pending;
+  if (!overflow.empty() && (overflowMin >> WHEEL_BITS) < this->epoch + RING_SIZE) {
+    pending.splice(pending.end(), overflow);
+    overflowMin = INF_TIME;
+  }
+  pending.splice(pending.end(), ring[this->epoch & (RING_SIZE - 1)]);
+  while (!pending.empty()) {
+    Flow* flow = &pending.front();
+    pending.pop_front();
+    this->place(flow);
+  }
+}
+
+void FlowQueue::settle() {
+  if (count == 0)
+    return;
+  while (wheelCount == 0)
+    this->nextEpoch();
+  while (wheel[cursor & (WHEEL_SIZE - 1)].empty())
+    cursor++;
+}
+
+void FlowQueue::push(Flow* flow) {
+  flow->queueKey = std::max(flow->getEta(), this->cursor);
+  this->place(flow);
+  count++;
+}
+
+Flow* FlowQueue::top() {
+  if (count == 0)
+    return nullptr;
+  this->settle();
+  return &wheel[cursor & (WHEEL_SIZE - 1)].front();
+}
+
+Flow* FlowQueue::peek(SimTime time) {
+  if ((time >> WHEEL_BITS) != this->epoch)
+    return nullptr;
+  FlowBucket& bucket = wheel[time & (WHEEL_SIZE - 1)];
+  if (bucket.empty())
+    return nullptr;
+  return &bucket.front();
+}
+
+void FlowQueue::pop() {
+  if (count == 0)
+    return;
+  this->settle();
+  this->unplace(&wheel[cursor & (WHEEL_SIZE - 1)].front());
+  count--;
+}
+
+void FlowQueue::update(Flow* flow) {
+  this->unplace(flow);
+  flow->queueKey = std::max(flow->getEta(), this->cursor);
+  this->place(flow);
+}
+
+void FlowQueue::clear() {
+  BOOST_FOREACH (FlowBucket& bucket, wheel)
+    bucket.clear();
+  BOOST_FOREACH (FlowBucket& bucket, ring)
+    bucket.clear();
+  overflow.clear();
+  overflowMin = INF_TIME;
+  wheelCount = 0;
+  count = 0;
+}
+
+void FlowQueue::remove(Flow* flow) {
+  this->unplace(flow);
+  count--;
+}
@@ -0,0 +1,147 @@
+/*
+ * File:   FlowQueue.hpp
+ * Author: emanuele
+ *
+ * Created on 16 October 2026, 10:12
+ */
+
+#ifndef FLOWQUEUE_HPP
+#define	FLOWQUEUE_HPP
+
+#include "Flow.hpp"
+#include "boost/intrusive/list.hpp"
+#include <vector>
+
+/**
+ * A calendar queue for the events of the Scheduler.
+ *
+ * Since the simulation clock has a granularity of one second and most events are
+ * scheduled between a few seconds and a few minutes in the future, the queue is
+ * organised on three tiers of unsorted buckets:
+ * - a wheel with one bucket per second, for the events falling in the current
+ *   epoch of FlowQueue::WHEEL_SIZE seconds;
+ * - a ring with one bucket per epoch, for the events falling in the following
+ *   FlowQueue::RING_SIZE - 1 epochs;
+ * - an overflow bucket for everything further in the future.
+ *
+ * Events are only moved to a lower tier when the clock reaches their epoch, so
+ * both insertions and extractions take amortised constant time. All the events
+ * in a bucket of the wheel share the same ETA; within a bucket they are extracted
+ * in order of insertion, except for Flows of type FlowType::TERMINATE, which
+ * always come after all the other events with the same ETA.
+ *
+ * The queue is intrusive: Flows are linked in the buckets through their
+ * Flow::queueHook, so no memory is allocated when they are scheduled, and a
+ * Flow can be moved to a different bucket without having to look it up first.
+ */
+class FlowQueue {
+public:
+  typedef boost::intrusive::list<Flow,
+          boost::intrusive::member_hook<Flow, QueueHook, &Flow::queueHook>,
+          boost::intrusive::constant_time_size<false> > FlowBucket;
+
+  static const uint WHEEL_BITS = 12; /**< Log2 of the number of seconds in an epoch. */
+  static const SimTime WHEEL_SIZE = 1 << WHEEL_BITS; /**< The number of buckets (i.e., seconds) in the wheel. */
+  static const SimTime RING_SIZE = 256; /**< The number of epochs covered by the ring, including the current one. */
+
+protected:
+  std::vector<FlowBucket> wheel; /**< One bucket for each second of the current epoch. */
+  std::vector<FlowBucket> ring; /**< One bucket for each of the epochs following the current one. */
+  FlowBucket overflow; /**< The events scheduled beyond the range of the ring. */
+  SimTime cursor; /**< The time of the bucket in the wheel currently being extracted. */
+  SimTime epoch; /**< The index of the epoch covered by the wheel. */
+  SimTime overflowMin; /**< A lower bound on the keys in the overflow bucket. */
+  size_t wheelCount; /**< The number of events currently in the wheel. */
+  size_t count; /**< The total number of events in the queue. */
+
+  /**
+   * Links a Flow in the bucket of the right tier, based on its Flow::queueKey.
+   * @param flow The Flow to be placed.
+   */
+  void place(Flow* flow);
+  /**
+   * Unlinks a Flow from the bucket it belongs to.
+   * @param flow The Flow to be removed.
+   */
+  void unplace(Flow* flow);
+  /**
+   * Moves the wheel to the next epoch which has pending events, and redistributes
+   * the events of that epoch in the buckets of the wheel.
+   */
+  void nextEpoch();
+  /**
+   * Moves the cursor forward to the first non-empty bucket of the wheel,
+   * changing epoch if necessary.
+   */
+  void settle();
+
+public:
+  FlowQueue();
+  ~FlowQueue();
+
+  /**
+   * Adds a new Flow to the queue, based on its current ETA.
+   * @param flow The Flow to be added.
+   */
+  void push(Flow* flow);
+  /**
+   * Retrieves the Flow with the lowest ETA, without removing it from the queue.
+   * @return The next Flow to be processed.
+   */
+  Flow* top();
+  /**
+   * Retrieves the first Flow scheduled at the specified time, without removing
+   * it from the queue. Unlike top(), this never moves the queue forward, so
+   * Flows can still be scheduled at the specified time afterwards.
+   * @param time The time of the Flow to be retrieved, which must not be earlier than the ETA of the last Flow extracted.
+   * @return The first Flow scheduled at the specified time, or nullptr if there is none.
+   */
+  Flow* peek(SimTime time);
+  /**
+   * Removes the Flow with the lowest ETA from the queue.
+   */
+  void pop();
+  /**
+   * Moves a Flow to the right bucket after its ETA has changed.
+   * @param flow A Flow which is currently in the queue.
+   */
+  void update(Flow* flow);
+  /**
+   * Removes all the events from the queue. The Flows themselves are not deleted.
+   */
+  void clear();
+  /**
+   * Removes a Flow from the queue, wherever it is. The Flow itself is not deleted.
+   * @param flow A Flow which is currently in the queue.
+   */
+  void remove(Flow* flow);
+  /**
+   * Applies a function to every Flow in the queue, in no particular order. The
+   * function must not add or remove Flows from the queue.
+   * @param visit The function to be applied, taking a Flow* as its argument.
+   */
+  template <typename Visitor>
+  void forEach(Visitor visit) {
+    BOOST_FOREACH (FlowBucket& bucket, wheel) {
+      BOOST_FOREACH (Flow& flow, bucket)
+        visit(&flow);
+    }
+    BOOST_FOREACH (FlowBucket& bucket, ring) {
+      BOOST_FOREACH (Flow& flow, bucket)
+        visit(&flow);
+    }
+    BOOST_FOREACH (Flow& flow, overflow)
+      visit(&flow);
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+};
+
+#endif	/* FLOWQUEUE_HPP */
+
@@ -95,6 +95,8 @@ void IPTVTopologyOracle::generateUserViewMap(Scheduler* scheduler) {
         sessionStart = 0;
       else if (sessionStart + sessionLength >= roundDuration)
         sessionStart = roundDuration - sessionLength;
+      // sessions are generated within the round, but time is absolute
+      sessionStart += scheduler->getRoundStart();
       SimTimeInterval interval(sessionStart, sessionStart + sessionLength);
       // store the new interval
       userWatchMap.at(user).dailySessionInterval = interval;
@@ -203,7 +205,7 @@ void IPTVTopologyOracle::generateNewRequest(PonUser user, SimTime time,
       if (i >= content->getTotalChunks())
         break;
       else {
-        Flow* request = new Flow(content, user, time, i);
+        Flow* request = scheduler->createFlow(content, user, time, i);
         scheduler->schedule(request);
         wIt->second.highestChunkFetched = i;
         BOOST_LOG_TRIVIAL(debug) << "Fetching chunk " << i << " of content "
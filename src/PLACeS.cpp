@@ -71,9 +71,12 @@ void printToFile(po::variables_map vm, Topology* topo, TopologyOracle* oracle) {
           << " -m " << vm["min-flow-increase"].as<double>()
           << " -k " << vm["peak-req-ratio"].as<uint>()
           << " -z " << vm["zm-exponent"].as<double>()
-          << " -O " << vm["optimize-caching"].as<bool>()
+          << " -O " << vm["optimize-caching"].as<uint>()
+          << " -Q " << vm["optimize-freq"].as<uint>()
           << " -n " << vm["chunk-size"].as<uint>()
-          << " -B " << vm["buffer-size"].as<uint>();
+          << " -B " << vm["buffer-size"].as<uint>()
+          << " -E " << vm["batch-events"].as<bool>()
+          << " -F " << vm["max-min-fair"].as<bool>();
   outputF << "% Parameters: " << ss.str() << endl;
   uint rounds = vm["rounds"].as<uint>();
   NetworkStats stats = topo->getNetworkStats();
@@ -244,18 +247,40 @@ int main(int argc, char** argv) {
               "Name of the output file with the results")
           ("snapshot-freq,f", po::value<uint>()->default_value(0),
               "Frequency at which to take graphml snapshots of the network")
+          ("snapshot-delta,y", po::value<bool>()->default_value(false),
+              "If true, only the first snapshot is a full graphml file, while the "
+              "following ones only list the edges that changed since the previous one")
           ("pre-caching,M", po::value<bool>()->default_value(false),
               "if true stores most popular content in AS caches (reduced-caching must be false)")
           ("peak-req-ratio,k", po::value<uint>()->default_value(100),
               "peak-to-average ratio of requests per hour, for popularity rate estimations")
-          ("optimize-caching,O", po::value<bool>()->default_value(true),
-              "If true, attempts to minimize storage space used for caching")
+          ("optimize-caching,O", po::value<uint>()->default_value(1),
+              "Solver used to minimize storage space used for caching: 0 = "
+              "no optimization, 1 = built-in solver, 2 = CPLEX (only if compiled with USE_CPLEX)")
+          ("optimize-freq,Q", po::value<uint>()->default_value(0),
+              "If >0, interval in seconds at which all the user caches of each AS are "
+              "optimized jointly, instead of optimizing a cache whenever a chunk is downloaded")
           ("zm-exponent,z", po::value<double>()->default_value(1),
               "maximum allowed value of the ZM distribution exponent parameter")
           ("chunk-size,n", po::value<uint>()->default_value(800),
               "size in Megabits of each content chunk")
           ("buffer-size,B", po::value<uint>()->default_value(10),
               "number of chunks that fit in the streaming buffer")
+          ("batch-events,E", po::value<bool>()->default_value(false),
+              "If true, processes all the events sharing the same time as a batch, "
+              "reallocating bandwidth only once per batch (faster but less accurate)")
+          ("max-min-fair,F", po::value<bool>()->default_value(false),
+              "If true, allocates bandwidth with an exact max-min fair algorithm "
+              "instead of the single bottleneck heuristic (slower but more accurate)")
+          ("routing-cache,T", po::value<std::string>()->default_value(""),
+              "Directory where the routing tables of each topology are cached "
+              "and reused by later runs (if empty, routes are always computed)")
+          ("convert-topology,X", po::value<std::string>(),
+              "Converts the topology to the binary format, writing it to the "
+              "specified .ptopo file, and exits without running any simulation")
+          ("fixed-pons,x", po::value<bool>()->default_value(false),
+              "If true, the converted topology stores the number of customers "
+              "of each PON instead of drawing it again every time it is loaded")
   ;
   
   po::variables_map vm;
@@ -270,6 +295,15 @@ int main(int argc, char** argv) {
   if (vm.count("topology") == 0) {
     topoFileNameVec.push_back(topoFileName);
   }
+#ifdef USE_CPLEX
+  if (vm["optimize-caching"].as<uint>() > CPLEX_SOLVER) {
+#else
+  if (vm["optimize-caching"].as<uint>() > BUILTIN_SOLVER) {
+#endif
+    std::cerr << "Unsupported value for optimize-caching: " 
+            << vm["optimize-caching"].as<uint>() << std::endl;
+    return ERR_INPUT_PARAMETERS;
+  }
   //Initialize the internal state of the pseudo-random generator
   gen.seed(vm["seed"].as<unsigned long>());
 
@@ -286,6 +320,21 @@ int main(int argc, char** argv) {
     topoVector.push_back(topo);
   }
 
+  // convert the topology to the binary format, if required
+  if (vm.count("convert-topology")) {
+    if (topoVector.size() != 1) {
+      BOOST_LOG_TRIVIAL(error) << "Exactly one topology must be specified to "
+              "convert it to the binary format";
+      return ERR_INPUT_PARAMETERS;
+    }
+    string binFileName = vm["convert-topology"].as<std::string>();
+    if (!topoVector.front()->saveBinary(binFileName, vm["fixed-pons"].as<bool>()))
+      return ERR_INPUT_PARAMETERS;
+    std::cout << "Topology " << topoVector.front()->getFileName() 
+            << " converted to " << binFileName << std::endl;
+    return 0;
+  }
+
   uint roundDuration = 0;
   TopologyOracle* oracle = nullptr;
   
@@ -8,15 +8,17 @@
 #ifndef PLACES_HPP
 #define	PLACES_HPP
 #include <limits>
+#include <cstdint>
 #include "boost/foreach.hpp"
 #include "boost/program_options.hpp"
 #include <boost/log/trivial.hpp>
 
 namespace po = boost::program_options;
 /**
- * Basic granularity of time in the simulator (1 second).
+ * Basic granularity of time in the simulator (1 second). Time is absolute, i.e.,
+ * it keeps increasing across simulation rounds, hence the 64 bits.
  */
-typedef int SimTime;
+typedef int64_t SimTime;
 /**
  * Measure of data size, bandwidth etc., expressed in Mbps.
  */
@@ -44,7 +46,7 @@ enum SimMode {VoD, IPTV};
  * i.e., the starting time of a transfer when a source has not been defined yet
  * or its ETA when the bandwidth assigned to that flow has not been defined.
  */
-const SimTime INF_TIME = std::numeric_limits<int>::max();
+const SimTime INF_TIME = std::numeric_limits<SimTime>::max();
 /**
  * UNKNOWN is used as a placeholder for an unspecified PonUser.
  * 
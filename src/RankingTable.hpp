@@ -34,9 +34,10 @@ protected:
     std::vector<uint> hits; /**< The metric used to determine the rank of an item; the more hits an item receives, the lower its rank. */
     std::vector<uint> roundHits; /**< The number of hits received by each item in the current round. */
     RankingBimap catalog; /**< The bi-directional map that represents the actual ranking table. */
+    unsigned long version; /**< Incremented whenever the rank of an item changes, or items are inserted or erased. */
     bool swap(uint a, uint b); 
 public:
-    RankingTable(){};
+    RankingTable() : version(0) {};
     void insert(Element e);
     void erase(Element e);
     void eraseByRank(uint rank);
@@ -53,6 +54,13 @@ public:
     uint getHitsByRank(uint rank) const;
     uint getRoundHitsByRank(uint rank) const;
     void resetRoundHits();
+    /**
+     * Returns the version of the ranking, which changes whenever the rank of 
+     * an Element changes (hits which do not alter the ranking leave it as is).
+     */
+    unsigned long getVersion() const {
+        return version;
+    }
     void printRanking() const {
         for (auto it = catalog.right.begin(); it != catalog.right.end(); it++)
         std::cout << "element " << it->second << " has rank " << it->first 
@@ -74,6 +82,7 @@ void RankingTable<Element>::insert(Element e) {
     // insert it at the end
     
     catalog.left.insert(std::make_pair(e,hits.size()));
+    version++;
     this->hits.push_back(0);
     this->roundHits.push_back(0);
     assert(hits.size() == catalog.left.size());
@@ -104,6 +113,7 @@ void RankingTable<Element>::eraseByRank(uint rank) {
     auto init = catalog.right.find(rank);
     if (init != catalog.right.end()) {
         catalog.right.erase(init);
+        version++;
         hits.erase(hits.begin()+rank);
         roundHits.erase(roundHits.begin()+rank);
         assert(catalog.right.size() == hits.size());
@@ -176,6 +186,7 @@ void RankingTable<Element>::clear() {
     catalog.clear();
     hits.clear();
     roundHits.clear();
+    version++;
 }
 
 /**
@@ -203,6 +214,7 @@ bool RankingTable<Element>::swap(uint a, uint b) {
 //    std::cout << std::endl;
     std::swap(hits.at(a), hits.at(b));
     std::swap(roundHits.at(a), roundHits.at(b));
+    version++;
 //    std::cout << "debug: hits after swap: ";
 //    for (auto vit = hits.begin(); vit != hits.end(); vit++)
 //        std::cout << *vit << " ";
@@ -9,6 +9,7 @@
 #define	RUNNINGAVG_HPP
 #include <utility>
 #include <iostream>
+#include <cfloat>
 /**
  * Keeps a time-weighted average of a certain metric. Every time a new measure
  * is taken, the class updates its running average by keeping track of the
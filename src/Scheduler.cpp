@@ -2,20 +2,38 @@
 #include "Scheduler.hpp"
 
 Scheduler::~Scheduler() {
-  // delete eventual flows still scheduled but not completed
-  handleMap.clear();
+  /* transfers still in flight are linked to the edges of the topology through
+   * EdgeLinks owned by the pool: unlink them before the pool frees its slabs,
+   * as the topology outlives the Scheduler
+   */
+  oracle->getTopology()->resetFlows();
+  std::vector<Flow*> pending;
+  pendingEvents.forEach([&pending](Flow* f) {
+    pending.push_back(f);
+  });
   pendingEvents.clear();
-  delete terminate;
+  BOOST_FOREACH (Flow* f, pending) {
+    this->releaseFlow(f);
+  }
 }
 
 void Scheduler::schedule(Flow* event) {
-  handleT handle = this->pendingEvents.push(event);
-  if (handleMap.insert(std::make_pair(event, handle)).second != true)
+  if (event->isScheduled())
   {
-    BOOST_LOG_TRIVIAL(error) << "Scheduler::schedule() - could not insert new handle in "
-            "handleMap";
+    BOOST_LOG_TRIVIAL(error) << "Scheduler::schedule() - flow is already in the "
+            "event queue";
     exit(ERR_HANDLEMAP_INSERT);
   }
+  this->pendingEvents.push(event);
+  // a REQUEST keeps its place when it is scheduled again as a TRANSFER
+  if (!event->roundHook.is_linked()) {
+    if (event->getFlowType() == FlowType::WATCH)
+      watchFlows.push_back(*event);
+    else if (mode == IPTV && event->getContent() != nullptr) {
+      int day = event->getContent()->getReleaseDay() % (int) IPTV_CONTENT_LIFETIME;
+      flowsByReleaseDay[day < 0 ? day + IPTV_CONTENT_LIFETIME : day].push_back(*event);
+    }
+  }
 }
 
 Scheduler::Scheduler(TopologyOracle* oracle, po::variables_map vm) 
@@ -33,17 +51,35 @@ Scheduler::Scheduler(TopologyOracle* oracle, po::variables_map vm)
   this->currentRound = 0;
   this->roundDuration = roundDuration;
   simTime = 0;
-  this->terminate = new Flow(nullptr, UNKNOWN, roundDuration);
+  roundStart = 0;
+  this->terminate = this->createFlow(nullptr, UNKNOWN, roundDuration);
   this->terminate->setFlowType(FlowType::TERMINATE);
   this->schedule(terminate);
   this->snapshotFreq = vm["snapshot-freq"].as<uint>();
+  this->batchEvents = vm["batch-events"].as<bool>();
   if (snapshotFreq > 0 && snapshotFreq <= roundDuration) {
-    this->snapshot = new Flow(nullptr, UNKNOWN, snapshotFreq);
+    this->snapshot = this->createFlow(nullptr, UNKNOWN, snapshotFreq);
     snapshot->setFlowType(FlowType::SNAPSHOT);
     this->schedule(this->snapshot);
   } else {
     this->snapshot = nullptr;
   }
+  this->optimizeFreq = vm["optimize-freq"].as<uint>();
+  /* with optimize-freq > 0 caches are no longer optimized at each download, so
+   * if the periodic optimization never fires within a round they would not be
+   * optimized at all
+   */
+  if (optimizeFreq >= roundDuration) {
+    BOOST_LOG_TRIVIAL(error) << "Scheduler::Scheduler() - optimize-freq (" 
+            << optimizeFreq << ") must be shorter than a round (" 
+            << roundDuration << " seconds)";
+    abort();
+  }
+  if (optimizeFreq > 0) {
+    Flow* optimize = this->createFlow(nullptr, UNKNOWN, optimizeFreq);
+    optimize->setFlowType(FlowType::OPTIMIZE);
+    this->schedule(optimize);
+  }
 }
 
 bool Scheduler::advanceClock() {
@@ -52,7 +88,7 @@ bool Scheduler::advanceClock() {
             "reaching the termination event" << std::endl;
     return false;
   }
-  Flow* nextEvent = const_cast<Flow*> (pendingEvents.top());
+  Flow* nextEvent = pendingEvents.top();
   // Check that the event is not scheduled in the past
   if (nextEvent->getSimTime() < this->getSimTime()) {
     BOOST_LOG_TRIVIAL(error) << "Scheduler::advanceClock() - Event scheduled in the past!";
@@ -67,24 +103,44 @@ bool Scheduler::advanceClock() {
     /* print current time on the screen at the current line (note: will mess up
      * printing with debug verbose
      */
-    std::cout<<"Current simulation time: " << this->simTime << "/"
+    std::cout<<"Current simulation time: " << this->simTime - this->roundStart << "/"
           << this->roundDuration << "\r" << std::flush;
   }
-  handleMap.erase(pendingEvents.top());
   pendingEvents.pop();
+  if (!this->batchEvents || !this->isBatchable(nextEvent))
+    return this->processEvent(nextEvent);
+  /* process all the flows sharing the current time as a single batch, so that
+   * the topology only recomputes the bandwidth allocation once for all of them
+   */
+  Topology* topo = oracle->getTopology();
+  topo->beginBatch();
+  bool result = this->processEvent(nextEvent);
+  /* peek rather than top, so that the queue does not move past the current 
+   * time: endBatch() may still reschedule some flows to complete right now
+   */
+  while ((nextEvent = pendingEvents.peek(this->simTime)) != nullptr
+          && this->isBatchable(nextEvent)) {
+    pendingEvents.pop();
+    result = this->processEvent(nextEvent) && result;
+  }
+  topo->endBatch(this);
+  return result;
+}
+
+bool Scheduler::processEvent(Flow* nextEvent) {
   // Determine what kind of event is this
   switch(nextEvent->getFlowType()) {
     case FlowType::TERMINATE:
       BOOST_LOG_TRIVIAL(info) << std::endl  
              << "Scheduler::advanceClock() - intercepted termination event";
-      delete nextEvent;
+      this->releaseFlow(nextEvent);
       return false;
     
     case FlowType::SNAPSHOT:
-      oracle->takeSnapshot(this->getSimTime(), this->getCurrentRound());
-      delete nextEvent;
-      if (this->getSimTime() + snapshotFreq <= roundDuration) {
-        this->snapshot = new Flow(nullptr, UNKNOWN,
+      oracle->takeSnapshot(this->getSimTime() - this->roundStart, this->getCurrentRound());
+      this->releaseFlow(nextEvent);
+      if (this->getSimTime() + snapshotFreq <= roundStart + roundDuration) {
+        this->snapshot = this->createFlow(nullptr, UNKNOWN,
                 this->getSimTime() + snapshotFreq);
         snapshot->setFlowType(FlowType::SNAPSHOT);
         this->schedule(this->snapshot);
@@ -93,6 +149,18 @@ bool Scheduler::advanceClock() {
       }
       return true;
     
+    case FlowType::OPTIMIZE:
+      oracle->optimizeCaches(this->getSimTime(), this->getCurrentRound());
+      this->releaseFlow(nextEvent);
+      // the next optimization must happen before the end of the round
+      if (this->getSimTime() + optimizeFreq < roundStart + roundDuration) {
+        Flow* optimize = this->createFlow(nullptr, UNKNOWN,
+                this->getSimTime() + optimizeFreq);
+        optimize->setFlowType(FlowType::OPTIMIZE);
+        this->schedule(optimize);
+      }
+      return true;
+    
     case FlowType::REQUEST: {
       // Change the start time to now and the eta to +1s until we know the 
       // available bandwidth 
@@ -106,11 +174,11 @@ bool Scheduler::advanceClock() {
       // also in that case we need to put the chunk in the watching buffer
       if (nextEvent->getSource() == nextEvent->getDestination()) {
         oracle->notifyCompletedFlow(nextEvent, this);
-        delete nextEvent;
+        this->releaseFlow(nextEvent);
       }
       else if (!success) {
         //TODO: retry to fetch the content at a later time
-        delete nextEvent;
+        this->releaseFlow(nextEvent);
       }
       return true;
     }
@@ -119,141 +187,84 @@ bool Scheduler::advanceClock() {
       // Notify the oracle, which will update the cache mapping and free resources
       // in the topology
       oracle->notifyCompletedFlow(nextEvent, this);
-      delete nextEvent;
+      this->releaseFlow(nextEvent);
       return true;      
+    default:
+      BOOST_LOG_TRIVIAL(error) << "Scheduler::processEvent() - unrecognized FlowType";
+      abort();
   }  
-  
-/*  if (nextEvent->getSource() == UNKNOWN) {
-    // This is a request, as the source hasn't been assigned yet
-    handleMap.erase(pendingEvents.top());
-    pendingEvents.pop();
-    // Check whether this is a special event
-    if (nextEvent->getDestination() == UNKNOWN && nextEvent->getContent() == nullptr) {
-      // termination event?
-      if (nextEvent->getSizeRequested() == 0) {
-      std::cout << std::endl  
-             << "Scheduler::advanceClock() - intercepted termination event"
-              << std::endl;
-      delete nextEvent;
-      return false;
-      } // snapshot event?
-      else if (nextEvent->getFlowType() == FlowType::SNAPSHOT) {
-        oracle->takeSnapshot(this->getSimTime(), this->getCurrentRound());
-        delete nextEvent;
-        if (this->getSimTime() + snapshotFreq <= roundDuration) {
-          this->snapshot = new Flow(nullptr, UNKNOWN, 0, 
-                  this->getSimTime() + snapshotFreq);
-          snapshot->setFlowType(FlowType::SNAPSHOT);
-          this->schedule(this->snapshot);
-        }
-        else {
-          this->snapshot = nullptr;
-        }
-        return true;
-      }
-    }
-    
-    // Change the start time to now and the eta to INF_TIME until we know the 
-    // available bandwidth 
-    nextEvent->setStart(this->getSimTime());
-    nextEvent->setEta(INF_TIME);
-    nextEvent->setLastUpdate(this->getSimTime());
-    // Ask the TopologyOracle to find a source for this content
-    // TODO: reschedule request in case of congestion
-    bool success = oracle->serveRequest(nextEvent, this);
-    // Check that the flow wasn't "virtual" (i.e. content was cached at the dest)
-    if (!success || nextEvent->getSource() == nextEvent->getDestination()) {
-      handleMap.erase(nextEvent);
-      delete nextEvent;
-    }
-    return true;
-  } else {
-//    std::cout << this->getSimTime() << ": Completed transfer of content " 
-//            << flow->getContent()->getName()
-//            << " from source " << flow->getSource().first
-//            << " to destination " << flow->getDestination().first << std::endl;
-    // Remove flow from top of the queue
-    pendingEvents.pop();
-    handleMap.erase(nextEvent);
-    // Notify the oracle, which will update the cache mapping and free resources
-    // in the topology
-    oracle->notifyCompletedFlow(nextEvent, this);
-    delete nextEvent;
-    return true;
-  }  
- */ 
 }
 
 
 void Scheduler::updateSchedule(Flow* flow, SimTime oldEta) {
-  if (handleMap.find(flow) != handleMap.end()) {
-    if (flow->getEta() > oldEta)
-      pendingEvents.decrease(handleMap[flow]);
-    else if (flow->getEta() < oldEta)
-      pendingEvents.increase(handleMap[flow]);
-    else
-      return;
+  if (flow->isScheduled()) {
+    if (flow->getEta() != oldEta)
+      pendingEvents.update(flow);
   }
   else {
-    BOOST_LOG_TRIVIAL(error) << "Scheduler::updateSchedule() - could not find handle for flow "
+    BOOST_LOG_TRIVIAL(error) << "Scheduler::updateSchedule() - flow is not in the event queue: "
             << flow->getSource().first << "->" << flow->getDestination().first;
     exit(ERR_NO_EVENT_HANDLE);
   }    
 }
 
 void Scheduler::startNewRound() {
-  // update flows so that they can be moved to the new round
-  std::vector<Flow*> flowVec;
-  while (pendingEvents.empty() == false) {
-    Flow* f = const_cast<Flow*> (pendingEvents.top());
-    pendingEvents.pop();
-    if (f->getFlowType() == FlowType::WATCH) {
-      // there is no point in carrying over watch flows, as they will be discarded
-      BOOST_LOG_TRIVIAL(trace) << "Deleting watch flow for chunk" << f->getChunkId()
-              << " of content " << f->getContent()->getName() << " for user "
-              << f->getDestination().first << "," << f->getDestination().second;
-      delete f;
+  /* since time is absolute, flows carried over to the new round can stay where
+   * they are in the queue; only the ones that cannot be completed are dropped
+   */
+  while (!watchFlows.empty()) {
+    Flow* f = &watchFlows.front();
+    watchFlows.pop_front();
+    // a flow being processed is linked again if it is scheduled
+    if (!f->isScheduled())
       continue;
-    }
-    f->updateSizeDownloaded(this->roundDuration);
-    f->setLastUpdate(0);
-    f->setStart(f->getStart() - this->roundDuration); // negative
-    SimTime oldEta = f->getEta();
-    if (oldEta < this->roundDuration) {
-      BOOST_LOG_TRIVIAL(error) << "Scheduler::startNewRound() - unresolved event has eta "
-              << oldEta << " < roundDuration";
-      abort();
-    }
-    f->setEta(oldEta - this->roundDuration);
-    if (this->mode == IPTV && f->getContent()->getReleaseDay() <= currentRound-6) {
+    // there is no point in carrying over watch flows, as they will be discarded
+    BOOST_LOG_TRIVIAL(trace) << "Deleting watch flow for chunk" << f->getChunkId()
+            << " of content " << f->getContent()->getName() << " for user "
+            << f->getDestination().first << "," << f->getDestination().second;
+    pendingEvents.remove(f);
+    this->releaseFlow(f);
+  }
+  if (this->mode == IPTV) {
+    // the contents released IPTV_CONTENT_LIFETIME-1 rounds ago expire now
+    int day = ((int) currentRound + 1) % (int) IPTV_CONTENT_LIFETIME;
+    RoundFlowList& expired = flowsByReleaseDay[day];
+    while (!expired.empty()) {
+      Flow* f = &expired.front();
+      expired.pop_front();
+      if (!f->isScheduled())
+        continue;
       // expired contents in IPTV will be deleted so flows can't be completed, 
       // this event should have been truncated last round
       BOOST_LOG_TRIVIAL(info) << "Scheduler::startNewRound() - carried over flow "
               "with expired content will not be completed";
+      pendingEvents.remove(f);
       if (f->getFlowType() == FlowType::TRANSFER) {
         // this is hacky, but needs to be done. Ideally we should not get here at all.
         oracle->getTopology()->updateCapacity(f, this, false);
         f->setContent(nullptr);
       }
-    } else
-      flowVec.push_back(f);
-  }
-  handleMap.clear();
-  BOOST_FOREACH (Flow* f, flowVec) {
-    this->schedule(f);
+      this->releaseFlow(f);
+    }
   }
-  flowVec.clear();
-  this->simTime = 0;
+  // give back the slabs emptied by the round just finished
+  flowPool.trim();
   this->currentRound++;
-  this->terminate = new Flow(nullptr, UNKNOWN, roundDuration);
+  this->roundStart += this->roundDuration;
+  this->terminate = this->createFlow(nullptr, UNKNOWN, roundStart + roundDuration);
   this->terminate->setFlowType(FlowType::TERMINATE);
   this->schedule(terminate);
   if (snapshotFreq > 0 && snapshotFreq <= roundDuration) {
-    this->snapshot = new Flow(nullptr, UNKNOWN, snapshotFreq);
+    this->snapshot = this->createFlow(nullptr, UNKNOWN, roundStart + snapshotFreq);
     snapshot->setFlowType(FlowType::SNAPSHOT);
     this->schedule(this->snapshot);
   } else {
     this->snapshot = nullptr;
   }
+  if (optimizeFreq > 0) {
+    Flow* optimize = this->createFlow(nullptr, UNKNOWN, roundStart + optimizeFreq);
+    optimize->setFlowType(FlowType::OPTIMIZE);
+    this->schedule(optimize);
+  }
   return;
-}
\ No newline at end of file
+}
@@ -9,32 +9,73 @@
 #define	SCHEDULER_HPP
 
 #include "Flow.hpp"
+#include "FlowPool.hpp"
+#include "FlowQueue.hpp"
 #include "TopologyOracle.hpp"
-#include <map>
-#include "boost/heap/pairing_heap.hpp"
+#include "boost/intrusive/list.hpp"
 
-typedef typename boost::heap::pairing_heap<Flow *, 
-        boost::heap::compare<CompareFlowPtr> > FlowQueue;
-typedef FlowQueue::handle_type handleT;
+/**
+ * The number of rounds a ContentElement stays in the catalog in IPTV mode; the
+ * Flows of the contents which expire are dropped at the end of the round.
+ */
+const uint IPTV_CONTENT_LIFETIME = 7;
 
 /**
  * The Scheduler manages the event queue of the simulation; it is responsible for
  * scheduling new events (in the form of Flows), keeping them sorted by increasing
  * ETAs, processing them one at a time and moving the clock forward whenever 
  * there are no more events at the current simulation time.
+ *
+ * Events are processed sequentially on a single queue. Partitioning the queue
+ * by Access Section (AS) would not allow any useful lookahead: a request can be
+ * served by a peer in any other AS or by the central server, and adding or
+ * removing a Flow immediately changes the bandwidth (and thus the ETA) of every
+ * Flow sharing a core or PON edge with it, regardless of their AS. The caches,
+ * the content maps and the popularity rankings in the TopologyOracle are shared
+ * across ASes as well. Batch mode (see Scheduler::batchEvents) is the supported
+ * way to reduce the cost of events that happen at the same time.
  */
 class Scheduler {
+  /**
+   * A list of the Flows to be dropped together at the end of a round.
+   */
+  typedef boost::intrusive::list<Flow,
+          boost::intrusive::member_hook<Flow, QueueHook, &Flow::roundHook>,
+          boost::intrusive::constant_time_size<false> > RoundFlowList;
 protected:
   SimMode mode; /**< Determines the simulation mode, i.e., VoD or IPTV. */
-  SimTime simTime; /**< The current time of this round of the simulation. */
+  SimTime simTime; /**< The current simulation time, counted from the beginning of the first round. */
+  SimTime roundStart; /**< The simulation time at which the current round started. */
   FlowQueue pendingEvents; /**< The event queue, where new Flows are sorted by increasing ETA. */
+  FlowPool flowPool; /**< The arena from which all the Flows of this simulation are allocated. */
   TopologyOracle* oracle; /**< A pointer to the TopologyOracle for this simulation. */
-  std::map<Flow*, handleT> handleMap; /**< A map matchign Flows with their handles in the event queue. It is required to update the ordering whenever the ETA for a Flow changes. */
   SimTime roundDuration; /**< The number of seconds that a simulation round should last in the current SimMode. */
   uint currentRound; /**< The index of teh current round. The first round has index 0. */
   SimTime snapshotFreq; /**< The frequency at which we should take graphml snapshots of the network, in seconds. If 0, no snapshot will be taken. */
   Flow* terminate; /**< A pointer to the termination Flow, which indicates that the current round is finised. */
   Flow* snapshot; /**< a pointer to the snapshot Flow, which indicates that a snapshot of the network should be exported to graphml. */
+  SimTime optimizeFreq; /**< The frequency at which the user caches should be optimized, in seconds. If 0, caches are optimized whenever a chunk is downloaded instead. */
+  bool batchEvents; /**< If true, all the Flows sharing the same ETA are processed as a single batch, and bandwidth is reallocated only once at the end of the batch. */
+  RoundFlowList watchFlows; /**< The scheduled WATCH Flows, which are not carried over to the next round. */
+  RoundFlowList flowsByReleaseDay[IPTV_CONTENT_LIFETIME]; /**< In IPTV mode, the other scheduled Flows of a ContentElement, by release day of the content modulo IPTV_CONTENT_LIFETIME, so that the Flows of the contents expiring at the end of a round can be found without visiting the whole queue. */
+  
+  /**
+   * Processes a single event which has already been removed from the queue.
+   * @param nextEvent The event to be processed.
+   * @return True if the event was processed normally, False if it was the termination event.
+   */
+  bool processEvent(Flow* nextEvent);
+  /**
+   * Checks whether an event can be processed as part of a batch, i.e., if it is
+   * a request, a transfer or a watch event.
+   * @param event The event to be checked.
+   * @return True if the event can be part of a batch, False otherwise.
+   */
+  bool isBatchable(Flow* event) const {
+    return event->getFlowType() != FlowType::TERMINATE 
+            && event->getFlowType() != FlowType::SNAPSHOT
+            && event->getFlowType() != FlowType::OPTIMIZE;
+  }
 public:
 /**
  * Simple constructor.
@@ -45,26 +86,55 @@ public:
   ~Scheduler();
   /**
    * Processes the next event in the queue. If the next event has an ETA greater
-   * than the current time, the latter is moved forward accordingly.
+   * than the current time, the latter is moved forward accordingly. In batch
+   * mode, all the Flows scheduled at the same time are processed together.
    * @return True if the event was processed normally, False if the termination event was encountered, meaning that we need to finish the current round.
    */
   bool advanceClock(); 
   /**
-   * Add a new Flow event to the queue.It will be inserted in the right position
-   * based on its ETA, and its handle will be saved in the handleMap.
+   * Add a new Flow event to the queue. It will be inserted in the right position
+   * based on its ETA; the Flow itself keeps track of its position in the queue.
    * @param event The Flow event to be added to the queue.
    */
   void schedule(Flow* event); 
+  /**
+   * Creates a new Flow, allocating it from the FlowPool of this simulation.
+   * @param args The arguments for the constructor of Flow.
+   * @return A pointer to the new Flow, which must be released with releaseFlow().
+   */
+  template <typename... Args>
+  Flow* createFlow(Args&&... args) {
+    return flowPool.create(std::forward<Args>(args)...);
+  }
+  /**
+   * Destroys a Flow which is not in the event queue, returning its memory to
+   * the FlowPool.
+   * @param flow The Flow to be destroyed.
+   */
+  void releaseFlow(Flow* flow) {
+    flowPool.destroy(flow);
+  }
+  /**
+   * Sets the route of a Flow, allocating from the FlowPool the links needed to
+   * keep it in the lists of active Flows of the Edges of the route.
+   * @param flow The Flow, which must not be linked to the Edges of its previous route.
+   * @param route The new route of the Flow.
+   */
+  void setRoute(Flow* flow, const Route& route) {
+    flowPool.setRoute(flow, route);
+  }
   /**
    * Updates the order of the event queue after one of the Flows has changed its 
    * ETA.
    * @param flow The Flow event whose ETA has changed.
-   * @param oldEta The ETA of the event before the change. Required to understand whether the ETA has increased or decreased.
+   * @param oldEta The ETA of the event before the change. If the ETA did not change, the queue is left untouched.
    */
   void updateSchedule(Flow* flow, SimTime oldEta);
   
   /**
-   * Retrieve the current simulation time.
+   * Retrieve the current simulation time. Time is absolute, i.e., it is not
+   * reset at the beginning of each round; use getRoundStart() to obtain the
+   * time elapsed in the current round.
    * @return The current simulation time.
    */
   SimTime getSimTime() const {
@@ -81,14 +151,24 @@ public:
   SimTime getRoundDuration() const {
     return roundDuration;
   }
+
+  /**
+   * Retrieve the simulation time at which the current round started.
+   * @return The absolute simulation time of the beginning of the current round.
+   */
+  SimTime getRoundStart() const {
+    return roundStart;
+  }
   
   /**
    * Performs a number of maintenance operations before starting a new simulation
-   * round. The events that are still in the queue (because their ETA was after
-   * the end of the previous round) are moved to a new ETA relative to the starting
-   * round. Events related to ContentElement that expired are deleted, and the related
-   * resources in the Topology must be freed. New terminate and snapshot Flows are
-   * generated for the round about to start.
+   * round. Since time is absolute, the events that are still in the queue 
+   * (because their ETA was after the end of the previous round) are left where
+   * they are, except for watching events and for events related to ContentElement 
+   * that expired, which are deleted (freeing the related resources in the 
+   * Topology); both are kept in separate lists, so the rest of the queue is not
+   * visited. The memory of the FlowPool which is no longer in use is released. 
+   * New terminate and snapshot Flows are generated for the round about to start.
    */
   void startNewRound();
 
@@ -0,0 +1,136 @@
+#include "SnapshotWriter.hpp"
+#include <fstream>
+#include <boost/graph/graphml.hpp>
+#include <boost/lexical_cast.hpp>
+
+SnapshotWriter::SnapshotWriter(DGraph& topology, const EdgeState& edgeState,
+        bool delta) :
+        topology(topology), edges(edgeState.edge), 
+        maxCapacity(edgeState.maxCapacity), delta(delta),
+        previous(nullptr), writing(false), stopping(false),
+        writer(&SnapshotWriter::run, this) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  writer.join();
+  delete previous;
+  BOOST_FOREACH(NetworkSnapshot* snapshot, spare) {
+    delete snapshot;
+  }
+}
+
+void SnapshotWriter::capture(SimTime time, uint round, const EdgeState& edgeState) {
+  NetworkSnapshot* snapshot = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    // don't let the simulation get too far ahead of the writer
+    changed.wait(lock, [this]() { return pending.size() < MAX_PENDING; });
+    if (!spare.empty()) {
+      snapshot = spare.back();
+      spare.pop_back();
+    }
+  }
+  if (snapshot == nullptr)
+    snapshot = new NetworkSnapshot();
+  // vector::assign reuses the memory of a recycled snapshot
+  snapshot->time = time;
+  snapshot->round = round;
+  snapshot->spareCapacity.assign(edgeState.spareCapacity.begin(),
+          edgeState.spareCapacity.end());
+  snapshot->peakCapacity.assign(edgeState.peakCapacity.begin(),
+          edgeState.peakCapacity.end());
+  snapshot->load.assign(edgeState.load.begin(), edgeState.load.end());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(snapshot);
+  }
+  changed.notify_all();
+}
+
+void SnapshotWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this]() { return pending.empty() && !writing; });
+}
+
+void SnapshotWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [this]() { return !pending.empty() || stopping; });
+    if (pending.empty())
+      return;
+    NetworkSnapshot* snapshot = pending.front();
+    pending.pop_front();
+    writing = true;
+    lock.unlock();
+    if (delta && previous != nullptr)
+      this->writeDelta(*snapshot);
+    else
+      this->writeGraphml(*snapshot);
+    NetworkSnapshot* written = previous;
+    previous = snapshot;
+    lock.lock();
+    if (written != nullptr)
+      spare.push_back(written);
+    writing = false;
+    changed.notify_all();
+  }
+}
+
+/* Prints a snapshot of the network topology in graphml format, so that it can
+ * be visualized through third party tools such as Gephi
+ */
+void SnapshotWriter::writeGraphml(NetworkSnapshot& snapshot) {
+  std::ofstream outG;
+  std::string index = boost::lexical_cast<std::string, uint>(snapshot.round) + "_" +
+          boost::lexical_cast<std::string, SimTime>(snapshot.time);
+  std::string filename = "./topologies/out_" + index + ".graphml";
+  outG.open(filename);
+  if (!outG.is_open()) {
+    BOOST_LOG_TRIVIAL(error) << "could not open output graph file " << filename;
+    abort();
+  }
+  auto idMap = boost::get(&NetworkEdge::id, topology);
+  boost::dynamic_properties dp;
+  dp.property("asid", boost::get(&NetworkNode::asid, topology));
+  dp.property("ponCustomers", boost::get(&NetworkNode::ponCustomers, topology));
+  dp.property("length", boost::get(&NetworkEdge::length, topology));
+  dp.property("maxCapacity",
+          boost::make_iterator_property_map(maxCapacity.begin(), idMap));
+  dp.property("spareCapacity",
+          boost::make_iterator_property_map(snapshot.spareCapacity.begin(), idMap));
+  dp.property("peakCapacity",
+          boost::make_iterator_property_map(snapshot.peakCapacity.begin(), idMap));
+  dp.property("totalLoad",
+          boost::make_iterator_property_map(snapshot.load.begin(), idMap));
+  //TODO: create property for central server identification
+  boost::write_graphml(outG, topology, dp);
+  outG.close();
+}
+
+void SnapshotWriter::writeDelta(const NetworkSnapshot& snapshot) const {
+  std::ofstream outD;
+  std::string index = boost::lexical_cast<std::string, uint>(snapshot.round) + "_" +
+          boost::lexical_cast<std::string, SimTime>(snapshot.time);
+  std::string filename = "./topologies/out_" + index + ".delta";
+  outD.open(filename);
+  if (!outD.is_open()) {
+    BOOST_LOG_TRIVIAL(error) << "could not open output delta file " << filename;
+    abort();
+  }
+  for (uint id = 0; id < snapshot.load.size(); id++) {
+    if (snapshot.spareCapacity[id] != previous->spareCapacity[id]
+            || snapshot.peakCapacity[id] != previous->peakCapacity[id]
+            || snapshot.load[id] != previous->load[id]) {
+      outD << id << " " << boost::source(edges[id], topology) << " "
+              << boost::target(edges[id], topology) << " " 
+              << snapshot.spareCapacity[id] << " " << snapshot.peakCapacity[id] 
+              << " " << snapshot.load[id] << "\n";
+    }
+  }
+  outD.close();
+}
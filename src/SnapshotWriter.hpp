@@ -0,0 +1,100 @@
+/*
+ * File:   SnapshotWriter.hpp
+ * Author: emanuele
+ *
+ * Created on 17 October 2026, 00:40
+ */
+
+#ifndef SNAPSHOTWRITER_HPP
+#define	SNAPSHOTWRITER_HPP
+
+#include "Topology.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * The per-edge counters of the Topology at a given time, indexed by
+ * NetworkEdge::id, i.e., everything that changes between two snapshots.
+ */
+struct NetworkSnapshot {
+  SimTime time; /**< The time of the snapshot, counted from the beginning of its round. */
+  uint round; /**< The simulation round during which the snapshot was taken. */
+  std::vector<Capacity> spareCapacity; /**< The EdgeState::spareCapacity of each edge. */
+  std::vector<Capacity> peakCapacity; /**< The EdgeState::peakCapacity of each edge. */
+  std::vector<Capacity> load; /**< The EdgeState::load of each edge. */
+};
+
+/**
+ * Writes the snapshots of the network in a background thread, so that the
+ * simulation only pays for copying the per-edge counters. Snapshots are written
+ * in the order they were taken, to ./topologies/out_<round>_<time>.graphml; in
+ * delta mode, only the first one is a full graphml file, while each of the
+ * following ones is written to ./topologies/out_<round>_<time>.delta and lists,
+ * one per line, the edges whose spare capacity, peak capacity or load changed
+ * since the previous snapshot, as "id source target spareCapacity peakCapacity
+ * totalLoad".
+ */
+class SnapshotWriter {
+public:
+  static const size_t MAX_PENDING = 4; /**< The number of snapshots that can be waiting to be written before capture() blocks. */
+
+protected:
+  DGraph& topology; /**< The graph of the Topology, which is not modified during the simulation. It is only read, but boost::dynamic_properties requires mutable property maps. */
+  std::vector<Edge> edges; /**< The descriptor of each edge, indexed by NetworkEdge::id. */
+  std::vector<Capacity> maxCapacity; /**< The maximum capacity of each edge, which does not change during the simulation. */
+  bool delta; /**< If true, all the snapshots but the first one only contain the edges that changed. */
+  NetworkSnapshot* previous; /**< The last snapshot written, used as the base of the next delta. Only accessed by the writer thread. */
+  std::deque<NetworkSnapshot*> pending; /**< The snapshots waiting to be written, in the order they were taken. */
+  std::vector<NetworkSnapshot*> spare; /**< Snapshots already written, whose vectors are reused by capture(). */
+  bool writing; /**< True while the writer thread is writing a snapshot. */
+  bool stopping; /**< Set when the writer is destroyed, to let the thread exit once the queue is empty. */
+  std::mutex mutex; /**< Protects pending, spare, writing and stopping. */
+  std::condition_variable changed; /**< Notified whenever a snapshot is queued or written. */
+  std::thread writer; /**< The background thread writing the snapshots. */
+
+  /**
+   * The main loop of the writer thread.
+   */
+  void run();
+  /**
+   * Writes a full graphml snapshot of the network.
+   * @param snapshot The snapshot to be written.
+   */
+  void writeGraphml(NetworkSnapshot& snapshot);
+  /**
+   * Writes the edges that changed between the previous snapshot and this one.
+   * @param snapshot The snapshot to be written.
+   */
+  void writeDelta(const NetworkSnapshot& snapshot) const;
+
+public:
+  /**
+   * Starts the writer thread.
+   * @param topology The graph of the Topology, which must outlive the writer.
+   * @param edgeState The state of the edges of the Topology, from which the edge descriptors and their maximum capacity are copied.
+   * @param delta If true, all the snapshots but the first one only contain the edges that changed.
+   */
+  SnapshotWriter(DGraph& topology, const EdgeState& edgeState, bool delta);
+  /**
+   * Writes all the pending snapshots and stops the writer thread.
+   */
+  ~SnapshotWriter();
+  /**
+   * Copies the current per-edge counters and queues them to be written. If
+   * MAX_PENDING snapshots are already waiting, blocks until one is written.
+   * @param time The time of the snapshot, counted from the beginning of the round.
+   * @param round The current simulation round.
+   * @param edgeState The current state of the edges of the Topology.
+   */
+  void capture(SimTime time, uint round, const EdgeState& edgeState);
+  /**
+   * Blocks until all the snapshots captured so far have been written.
+   */
+  void flush();
+};
+
+#endif	/* SNAPSHOTWRITER_HPP */
+
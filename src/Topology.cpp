@@ -1,6 +1,7 @@
 #include "Topology.hpp"
 #include <fstream>
 #include "Scheduler.hpp"
+#include "SnapshotWriter.hpp"
 
 #include <boost/graph/detail/adjacency_list.hpp>
 #include <sstream>
@@ -10,24 +11,37 @@
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/graph/graphml.hpp>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 extern boost::mt19937 gen;
 
+/* Utility method to compute a 64 bit FNV-1a hash of the content of a file, 
+ * which identifies the input file of a topology in the routing cache
+ */
+static uint64_t hashFile(const string& fileName) {
+  uint64_t hash = 14695981039346656037ULL;
+  std::ifstream stream(fileName.c_str(), std::ios::binary);
+  char buffer[1 << 16];
+  while (stream.read(buffer, sizeof(buffer)) || stream.gcount() > 0) {
+    for (std::streamsize i = 0; i < stream.gcount(); i++) {
+      hash ^= (unsigned char) buffer[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
 /* Utility method to add a PON link to the network
  */
 bool Topology::addEdge(Vertex src, Vertex dest, Capacity cap, EdgeType type = CORE) {
   auto result = boost::add_edge(src, dest, this->topology);
   if (result.second) {
-    if (cap < 0) {
-      // this link capacity is unlimited
-      topology[result.first].maxCapacity = UNLIMITED;
-      topology[result.first].spareCapacity = UNLIMITED;
-    } else {
-      topology[result.first].maxCapacity = cap;
-      topology[result.first].spareCapacity = cap;
-    }
-    topology[result.first].peakCapacity = 0;
-    topology[result.first].type = type;    
+    this->registerEdge(result.first, cap, type);
   } else {
     BOOST_LOG_TRIVIAL(warning) << "Topology::Topology() - could not add edge between vertices "
             << src << " and " << dest << std::endl;
@@ -35,8 +49,29 @@ bool Topology::addEdge(Vertex src, Vertex dest, Capacity cap, EdgeType type = CO
   return result.second;
 }
 
+void Topology::registerEdge(Edge e, Capacity cap, EdgeType type) {
+  topology[e].id = edgeState.edge.size();
+  edgeState.edge.push_back(e);
+  edgeState.type.push_back(type);
+  // if the capacity is negative, this link is unlimited
+  if (cap < 0)
+    cap = UNLIMITED;
+  edgeState.maxCapacity.push_back(cap);
+  edgeState.spareCapacity.push_back(cap);
+  edgeState.peakCapacity.push_back(0);
+  edgeState.load.push_back(0);
+  edgeState.activeFlows.emplace_back();
+  edgeState.congested.push_back(false);
+}
+
+Topology::~Topology() {
+  delete snapshotWriter;
+}
+
 Topology::Topology(string fileName, po::variables_map vm) {
   this->minFlowIncrease = std::max(vm["min-flow-increase"].as<double>(),0.0);
+  this->batchMode = false;
+  this->maxMinFair = vm["max-min-fair"].as<bool>();
   this->fileName = fileName;
   this->bitrate = vm["bitrate"].as<uint>();
   uint ponCardinality = vm["pon-cardinality"].as<uint>();
@@ -45,27 +80,22 @@ Topology::Topology(string fileName, po::variables_map vm) {
   numMetroEdges = 0;
   numCoreEdges = 0;
   numCustomers = 0;
-  // initialize dynamic_properties for the network snapshot if needed
-  if (vm["snapshot-freq"].as<uint>() > 0) {
-    snapDp.property("asid", boost::get(&NetworkNode::asid, topology));
-    snapDp.property("ponCustomers", boost::get(&NetworkNode::ponCustomers, topology));
-    snapDp.property("length", boost::get(&NetworkEdge::length, topology));
-    snapDp.property("maxCapacity", boost::get(&NetworkEdge::maxCapacity, topology));
-    snapDp.property("spareCapacity", boost::get(&NetworkEdge::spareCapacity, topology));
-    snapDp.property("peakCapacity", boost::get(&NetworkEdge::peakCapacity, topology));
-    boost::associative_property_map<LoadMap> loadPMap(this->loadMap);
-    snapDp.property("totalLoad", loadPMap);
-    //TODO: create property for central server identification
-  }
-  
+  numASes = 0;
   ifstream stream;
   string graphml = ".graphml";
+  string binary = ".ptopo";
   stream.open(fileName.c_str());
   if (!stream.is_open()) {
     cerr << "ERROR: Topology::Topology() - Could not open specified input "
             "file " << fileName.c_str() << endl;
 	  abort();
   }
+  else if (fileName.length() > binary.length() &&
+    0 == fileName.compare(fileName.length()-binary.length(),binary.length(),binary)) 
+  {
+    // read it as a binary topology written by saveBinary()
+    this->readBinary(fileName, ponCardinality);
+  }
   else if (fileName.length() > graphml.length() &&
     0 == fileName.compare(fileName.length()-graphml.length(),graphml.length(),graphml)) 
   {
@@ -75,9 +105,11 @@ Topology::Topology(string fileName, po::variables_map vm) {
     dp.property("asid", boost::get(&NetworkNode::asid, topology));
     dp.property("ponCustomers", boost::get(&NetworkNode::ponCustomers, topology));
     dp.property("length", boost::get(&NetworkEdge::length, topology));
-    dp.property("maxCapacity", boost::get(&NetworkEdge::maxCapacity, topology));
-    dp.property("spareCapacity", boost::get(&NetworkEdge::spareCapacity, topology));
-    dp.property("peakCapacity", boost::get(&NetworkEdge::peakCapacity, topology));
+    // the capacity is part of the EdgeState, which is only built after reading
+    std::map<Edge, Capacity> capacityMap;
+    boost::associative_property_map<std::map<Edge, Capacity> >
+        capacityPMap(capacityMap);
+    dp.property("maxCapacity", capacityPMap);
     // trying to read EdgeType as we did above generates errors with boost::lexical_cast
     // hence I create an int map and I then assign the values manually
     std::map<Edge, int> edgeTypeMap;
@@ -139,20 +171,12 @@ Topology::Topology(string fileName, po::variables_map vm) {
                 << e.m_source << "-" << e.m_target << ", defaulting to CORE";
         type = CORE;
       }
-      topology[e].type = type;
-      
-      if (topology[e].type == CORE)
+      if (type == CORE)
         numCoreEdges++;
-      else if (topology[e].type == METRO)
+      else if (type == METRO)
         numMetroEdges++;
-      // if capacity of some edge is negative, make it unlimited  
-      if (topology[e].maxCapacity < 0) {
-        topology[e].maxCapacity = UNLIMITED;
-        topology[e].spareCapacity = UNLIMITED;
-      } else {
-        topology[e].spareCapacity = topology[e].maxCapacity;
-      }
-      topology[e].peakCapacity = 0;
+      // if capacity of some edge is negative, it is made unlimited
+      this->registerEdge(e, capacityMap.at(e), type);
     }
     // collect core vertices (the ones defined in the graph))
     VertexVec coreVertices(boost::vertices(topology).first, 
@@ -168,6 +192,8 @@ Topology::Topology(string fileName, po::variables_map vm) {
         this->numASes++;
       if (csMap.at(v) == true)
         centralServer = boost::vertex(v, topology);
+      TopologyFileCore distribution = {(double) avgPonC, devPonC};
+      ponDistribution.push_back(distribution);
       boost::random::normal_distribution<> ponDist(avgPonC, devPonC);
       int ponC(0), ponNum(numPonMap.at(v));
       Capacity upCapacity(upCapMap.at(v)), downCapacity(downCapMap.at(v));
@@ -233,6 +259,8 @@ Topology::Topology(string fileName, po::variables_map vm) {
         if (cs.compare("cs") == 0)
           centralServer = boost::vertex(i, topology);
       }
+      TopologyFileCore distribution = {avgPonC, devPonC};
+      ponDistribution.push_back(distribution);
       boost::random::normal_distribution<> ponDist(avgPonC, devPonC);
       // for each PON node, determine the number of active customers
       uint asCustomers = 0;
@@ -281,31 +309,75 @@ Topology::Topology(string fileName, po::variables_map vm) {
     numEdges = boost::num_edges(topology);
   }
   stream.close();
-  // Finds shortest path distances between all pairs of vertices
-  for ( unsigned int vIt = 0; getPonCustomers(vIt) == 0; vIt++) {
-    Vertex v = boost::vertex(vIt, topology);
-    /* new approach: you don't actually need pMaps for ONU nodes, you know 
-     you have to go into the core node (the only outEdge you have) and from
-     there you can use that node's pMap. Distance is distance from that node +1 
-     */
-    assert(topology[vIt].ponCustomers == 0);
-    std::vector<Vertex> pVec;
-    pVec.resize(numVertices, vIt);
-    std::vector<unsigned int> dVec;
-    dVec.resize(numVertices, 0);
-    boost::dijkstra_shortest_paths(topology, v,
-            boost::weight_map(boost::get(&NetworkEdge::length, topology)).
-            predecessor_map(&pVec[0]).
-            distance_map(&dVec[0]));
-    auto rValue = dMap.insert(std::make_pair(v, dVec));
-    assert (rValue.second == true);
-    auto rValue2 = pMap.insert(std::make_pair(vIt, pVec));
-    assert(rValue2.second == true);
-  }
-  // Initialize Network statistics
-  BOOST_FOREACH(Edge e, boost::edges(topology)) {
-    loadMap.insert(std::pair<Edge, Capacity>(e,0));
+  // metro/core vertices are added first, PON vertices follow
+  numCoreVertices = 0;
+  while (numCoreVertices < numVertices && getPonCustomers(numCoreVertices) == 0)
+    numCoreVertices++;
+  /* Finds shortest path distances and routes between all pairs of vertices;
+   * routes only depend on the metro/core graph read from the input file, so 
+   * if a routing cache is in use, those computed by a previous run on the 
+   * same file are reused.
+   */
+  string cacheDir = vm["routing-cache"].as<string>();
+  if (cacheDir.empty()) {
+    this->computeRoutes();
+  } else {
+    uint64_t key = hashFile(fileName);
+    std::ostringstream cacheName;
+    cacheName << boost::filesystem::path(fileName).filename().string() << "."
+            << std::hex << key << ".routes";
+    string cacheFile = (boost::filesystem::path(cacheDir) / cacheName.str()).string();
+    if (!this->loadRoutes(cacheFile, key)) {
+      this->computeRoutes();
+      boost::system::error_code ec;
+      boost::filesystem::create_directories(cacheDir, ec);
+      this->saveRoutes(cacheFile, key);
+    }
+  }
+  // record the access edges of each PON, which are prepended/appended to routes
+  accessNode.resize(numVertices);
+  upEdges.resize(numVertices);
+  downEdges.resize(numVertices);
+  for (Vertex v = 0; v < numCoreVertices; v++)
+    accessNode[v] = v;
+  BOOST_FOREACH(Vertex pon, ponNodes) {
+    // NOTE: as the graph is not bidirectedS, in_edges is not available
+    assert(boost::out_degree(pon, topology) == 1);
+    upEdges[pon] = *(boost::out_edges(pon, topology).first);
+    accessNode[pon] = boost::target(upEdges[pon], topology);
+    std::pair<Edge, bool> returnValue = boost::edge(accessNode[pon], pon, topology);
+    assert(returnValue.second == true);
+    downEdges[pon] = returnValue.first;
+  }
+  // sort the other ASes of each AS by the hop count of their route towards it
+  asProximity.assign(numASes, std::vector<uint>());
+  for (uint asid = 0; asid < numASes; asid++) {
+    Vertex dest = asCacheMap.at(asid);
+    std::vector<std::pair<uint, uint> > byHops;
+    for (uint other = 0; other < numASes; other++) {
+      std::size_t index = (std::size_t) asCacheMap.at(other) * numCoreVertices + dest;
+      uint hops = routeOffsets[index+1] - routeOffsets[index];
+      // no route means that the AS cannot reach asid at all
+      if (other != asid && hops > 0)
+        byHops.push_back(std::make_pair(hops, other));
+    }
+    std::sort(byHops.begin(), byHops.end());
+    for (uint i = 0; i < byHops.size(); i++)
+      asProximity[asid].push_back(byHops[i].second);
   }
+  // flag the edges that are too narrow for the bitrate even when idle
+  ponCongestion.assign(numVertices, 0);
+  fairShare.edgeSlot.assign(edgeState.edge.size(), std::numeric_limits<uint>::max());
+  fairShare.stamp = 0;
+  numCongestedCore = 0;
+  for (uint id = 0; id < edgeState.edge.size(); id++)
+    this->updateCongestion(id);
+  // start the background writer for the network snapshots if needed
+  if (vm["snapshot-freq"].as<uint>() > 0)
+    snapshotWriter = new SnapshotWriter(topology, edgeState, 
+            vm["snapshot-delta"].as<bool>());
+  else
+    snapshotWriter = nullptr;
   // reserve memory for the historical stats vectors
   uint numRounds = vm.at("rounds").as<uint>();
   stats.avgTot.assign(numRounds, 0);
@@ -324,6 +396,335 @@ Topology::Topology(string fileName, po::variables_map vm) {
   
 }
 
+void Topology::computeRoutes() {
+  const uint n = numCoreVertices;
+  /* PON vertices don't need their own shortest path tree: their only out edge
+   * goes to their metro/core vertex, and from there we can use that vertex's.
+   * The trees of the metro/core vertices are independent of each other, so 
+   * they are computed by a pool of threads, each writing the rows of the dense
+   * distance and predecessor matrices for the sources it picked up.
+   */
+  const std::size_t numPairs = (std::size_t) n * n;
+  distances.assign(numPairs, 0);
+  std::vector<Vertex> predecessors(numPairs);
+  std::atomic<uint> nextSource(0);
+  auto worker = [&]() {
+    std::vector<Vertex> pVec(numVertices);
+    std::vector<uint> dVec(numVertices);
+    for (uint source = nextSource++; source < n; source = nextSource++) {
+      assert(topology[source].ponCustomers == 0);
+      boost::dijkstra_shortest_paths(topology, boost::vertex(source, topology),
+              boost::weight_map(boost::get(&NetworkEdge::length, topology)).
+              predecessor_map(&pVec[0]).
+              distance_map(&dVec[0]));
+      std::copy(dVec.begin(), dVec.begin() + n, distances.begin() + (std::size_t) source * n);
+      std::copy(pVec.begin(), pVec.begin() + n, predecessors.begin() + (std::size_t) source * n);
+    }
+  };
+  uint numThreads = std::min(std::max(std::thread::hardware_concurrency(), 1u), 
+          std::max(n, 1u));
+  std::vector<std::thread> threads;
+  for (uint i = 1; i < numThreads; i++)
+    threads.push_back(std::thread(worker));
+  worker();
+  BOOST_FOREACH(std::thread& t, threads) {
+    t.join();
+  }
+  /* store the route between every pair of metro/core vertices in the route 
+   * table, walking back through the predecessors and recording the edges in
+   * the right order; routes towards unreachable vertices are left empty
+   */
+  routeEdges.clear();
+  routeOffsets.clear();
+  routeOffsets.reserve(numPairs + 1);
+  routeOffsets.push_back(0);
+  VertexVec visitedNodes;
+  for (Vertex source = 0; source < n; source++) {
+    const Vertex* pRow = &predecessors[(std::size_t) source * n];
+    for (Vertex dest = 0; dest < n; dest++) {
+      visitedNodes.clear();
+      Vertex currentNode = dest;
+      while (currentNode != source && pRow[currentNode] != currentNode) {
+        visitedNodes.push_back(currentNode);
+        currentNode = pRow[currentNode];
+      }
+      if (currentNode == source) {
+        visitedNodes.push_back(source);
+        for (VertexVec::reverse_iterator rvIt = visitedNodes.rbegin(); 
+                rvIt+1 != visitedNodes.rend(); rvIt++) {
+          std::pair<Edge, bool> returnValue = boost::edge(*rvIt, *(rvIt+1), topology);
+          assert(returnValue.second == true);
+          routeEdges.push_back(returnValue.first);
+        }
+      }
+      routeOffsets.push_back(routeEdges.size());
+    }
+  }
+}
+
+bool Topology::loadRoutes(const string& cacheFile, uint64_t key) {
+  namespace bip = boost::interprocess;
+  boost::system::error_code ec;
+  if (!boost::filesystem::exists(cacheFile, ec))
+    return false;
+  try {
+    bip::file_mapping file(cacheFile.c_str(), bip::read_only);
+    bip::mapped_region region(file, bip::read_only);
+    const char* data = static_cast<const char*>(region.get_address());
+    std::size_t size = region.get_size();
+    if (size < sizeof(RouteCacheHeader)) {
+      BOOST_LOG_TRIVIAL(warning) << "Topology::loadRoutes() - routing cache "
+              << cacheFile << " is truncated, recomputing routes";
+      return false;
+    }
+    const RouteCacheHeader* header = reinterpret_cast<const RouteCacheHeader*>(data);
+    const uint n = numCoreVertices;
+    const std::size_t numPairs = (std::size_t) n * n;
+    if (std::memcmp(header->magic, ROUTE_CACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != ROUTE_CACHE_VERSION || header->key != key
+            || header->numVertices != numVertices || header->numEdges != numEdges
+            || header->numCoreVertices != n) {
+      BOOST_LOG_TRIVIAL(warning) << "Topology::loadRoutes() - routing cache "
+              << cacheFile << " does not match this topology, recomputing routes";
+      return false;
+    }
+    std::size_t numRouteEdges = header->numRouteEdges;
+    if (size != sizeof(RouteCacheHeader) 
+            + sizeof(uint32_t) * (2 * numPairs + 1 + numRouteEdges)) {
+      BOOST_LOG_TRIVIAL(warning) << "Topology::loadRoutes() - routing cache "
+              << cacheFile << " has the wrong size, recomputing routes";
+      return false;
+    }
+    const uint32_t* dist = reinterpret_cast<const uint32_t*>(data + sizeof(RouteCacheHeader));
+    const uint32_t* offsets = dist + numPairs;
+    const uint32_t* edgeIds = offsets + numPairs + 1;
+    // a corrupted table would make getRoute() read past the end of routeEdges
+    bool valid = offsets[0] == 0 && offsets[numPairs] == numRouteEdges;
+    for (std::size_t i = 0; valid && i < numPairs; i++)
+      valid = offsets[i] <= offsets[i+1];
+    for (std::size_t i = 0; valid && i < numRouteEdges; i++)
+      valid = edgeIds[i] < numEdges;
+    if (!valid) {
+      BOOST_LOG_TRIVIAL(warning) << "Topology::loadRoutes() - routing cache "
+              << cacheFile << " is corrupted, recomputing routes";
+      return false;
+    }
+    distances.assign(dist, dist + numPairs);
+    routeOffsets.assign(offsets, offsets + numPairs + 1);
+    routeEdges.clear();
+    routeEdges.reserve(numRouteEdges);
+    for (std::size_t i = 0; i < numRouteEdges; i++)
+      routeEdges.push_back(edgeState.edge[edgeIds[i]]);
+  } catch (bip::interprocess_exception& e) {
+    BOOST_LOG_TRIVIAL(warning) << "Topology::loadRoutes() - could not map "
+            "routing cache " << cacheFile << ": " << e.what();
+    return false;
+  }
+  BOOST_LOG_TRIVIAL(info) << "Loaded routes from " << cacheFile;
+  return true;
+}
+
+void Topology::saveRoutes(const string& cacheFile, uint64_t key) const {
+  static_assert(sizeof(uint) == sizeof(uint32_t), 
+          "the routing cache stores distances and offsets as 32 bit integers");
+  RouteCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, ROUTE_CACHE_MAGIC, sizeof(header.magic));
+  header.version = ROUTE_CACHE_VERSION;
+  header.key = key;
+  header.numVertices = numVertices;
+  header.numEdges = numEdges;
+  header.numCoreVertices = numCoreVertices;
+  header.numRouteEdges = routeEdges.size();
+  std::vector<uint32_t> edgeIds;
+  edgeIds.reserve(routeEdges.size());
+  BOOST_FOREACH(Edge e, routeEdges) {
+    edgeIds.push_back(topology[e].id);
+  }
+  /* write to a temporary file and rename it, so that concurrent runs on the 
+   * same topology never see a partially written cache
+   */
+  boost::system::error_code ec;
+  boost::filesystem::path tmpFile = boost::filesystem::unique_path(
+          cacheFile + ".%%%%-%%%%.tmp", ec);
+  std::ofstream stream(tmpFile.string().c_str(), std::ios::binary);
+  if (ec || !stream.is_open()) {
+    BOOST_LOG_TRIVIAL(warning) << "Topology::saveRoutes() - could not write "
+            "routing cache " << cacheFile;
+    return;
+  }
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  stream.write(reinterpret_cast<const char*>(distances.data()), 
+          distances.size() * sizeof(uint32_t));
+  stream.write(reinterpret_cast<const char*>(routeOffsets.data()), 
+          routeOffsets.size() * sizeof(uint32_t));
+  stream.write(reinterpret_cast<const char*>(edgeIds.data()), 
+          edgeIds.size() * sizeof(uint32_t));
+  stream.close();
+  if (stream.fail()) {
+    BOOST_LOG_TRIVIAL(warning) << "Topology::saveRoutes() - could not write "
+            "routing cache " << cacheFile;
+    boost::filesystem::remove(tmpFile, ec);
+    return;
+  }
+  boost::filesystem::rename(tmpFile, cacheFile, ec);
+  if (ec) {
+    BOOST_LOG_TRIVIAL(warning) << "Topology::saveRoutes() - could not write "
+            "routing cache " << cacheFile << ": " << ec.message();
+    boost::filesystem::remove(tmpFile, ec);
+  }
+}
+
+void Topology::readBinary(const string& fileName, uint ponCardinality) {
+  namespace bip = boost::interprocess;
+  try {
+    bip::file_mapping file(fileName.c_str(), bip::read_only);
+    bip::mapped_region region(file, bip::read_only);
+    const char* data = static_cast<const char*>(region.get_address());
+    std::size_t size = region.get_size();
+    const TopologyFileHeader* header = reinterpret_cast<const TopologyFileHeader*>(data);
+    if (size < sizeof(TopologyFileHeader) 
+            || std::memcmp(header->magic, TOPOLOGY_FILE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != TOPOLOGY_FILE_VERSION) {
+      BOOST_LOG_TRIVIAL(error) << "Topology::readBinary() - " << fileName 
+              << " is not a binary topology file";
+      abort();
+    }
+    const uint nv = header->numVertices;
+    const uint nc = header->numCoreVertices;
+    const uint ne = header->numEdges;
+    if (nc > nv || size != sizeof(TopologyFileHeader) 
+            + nv * sizeof(TopologyFileVertex) + nc * sizeof(TopologyFileCore)
+            + ne * sizeof(TopologyFileEdge)) {
+      BOOST_LOG_TRIVIAL(error) << "Topology::readBinary() - binary topology file "
+              << fileName << " is truncated or corrupted";
+      abort();
+    }
+    const TopologyFileVertex* vertices = 
+            reinterpret_cast<const TopologyFileVertex*>(data + sizeof(TopologyFileHeader));
+    const TopologyFileCore* cores = 
+            reinterpret_cast<const TopologyFileCore*>(vertices + nv);
+    const TopologyFileEdge* edges = 
+            reinterpret_cast<const TopologyFileEdge*>(cores + nc);
+    for (uint v = 0; v < nv; v++) {
+      Vertex node = boost::add_vertex(topology);
+      topology[node].asid = vertices[v].asid;
+      topology[node].ponCustomers = vertices[v].ponCustomers;
+    }
+    if (header->centralServer < nv)
+      centralServer = boost::vertex(header->centralServer, topology);
+    ponDistribution.assign(cores, cores + nc);
+    /* edges are stored by NetworkEdge::id, which keeps the out edges of each 
+     * vertex in the same order as in the converted topology, and hence yields
+     * the same shortest routes; it also gives edges the same ids
+     */
+    VertexVec parent(nv, nv);
+    for (uint i = 0; i < ne; i++) {
+      const TopologyFileEdge& record = edges[i];
+      if (record.source >= nv || record.target >= nv || record.type >= UNKNOWN_TYPE) {
+        BOOST_LOG_TRIVIAL(error) << "Topology::readBinary() - invalid edge " 
+                << i << " in binary topology file " << fileName;
+        abort();
+      }
+      auto result = boost::add_edge(record.source, record.target, topology);
+      assert(result.second);
+      topology[result.first].length = record.length;
+      this->registerEdge(result.first, record.maxCapacity, (EdgeType) record.type);
+      if (record.type == CORE)
+        numCoreEdges++;
+      else if (record.type == METRO)
+        numMetroEdges++;
+      else if (record.type == DOWNSTREAM)
+        parent[record.target] = record.source;
+    }
+    /* the PONs of each metro/core vertex follow those of the previous one, 
+     * hence drawing their customers in vertex order consumes the random 
+     * generator as the original topology file did
+     */
+    std::vector<uint> asCustomers(nc, 0);
+    Vertex current = nv;
+    boost::random::normal_distribution<> ponDist;
+    for (Vertex pon = nc; pon < nv; pon++) {
+      if (parent[pon] >= nc) {
+        BOOST_LOG_TRIVIAL(error) << "Topology::readBinary() - PON vertex " << pon
+                << " in binary topology file " << fileName << " has no metro/core vertex";
+        abort();
+      }
+      if (parent[pon] != current) {
+        current = parent[pon];
+        ponDist = boost::random::normal_distribution<>(
+                ponDistribution[current].avgPonCustomers, 
+                ponDistribution[current].devPonCustomers);
+      }
+      // checks if the topology values should be overridden
+      if (ponCardinality > 0)
+        topology[pon].ponCustomers = ponCardinality;
+      else if (header->fixedPons == 0)
+        topology[pon].ponCustomers = std::max((int) std::floor(ponDist(gen) + 0.5), 0);
+      numCustomers += topology[pon].ponCustomers;
+      asCustomers[current] += topology[pon].ponCustomers;
+      ponNodes.push_back(pon);
+    }
+    this->numASes = 0;
+    for (Vertex v = 0; v < nc; v++) {
+      if (asCacheMap.insert(std::make_pair(topology[v].asid, v)).second == true)
+        this->numASes++;
+      ASCustomersMap.insert(std::make_pair(topology[v].asid, asCustomers[v]));
+    }
+  } catch (bip::interprocess_exception& e) {
+    BOOST_LOG_TRIVIAL(error) << "Topology::readBinary() - could not map binary "
+            "topology file " << fileName << ": " << e.what();
+    abort();
+  }
+  numVertices = boost::num_vertices(topology);
+  numEdges = boost::num_edges(topology);
+}
+
+bool Topology::saveBinary(const string& binFileName, bool fixedPons) const {
+  TopologyFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, TOPOLOGY_FILE_MAGIC, sizeof(header.magic));
+  header.version = TOPOLOGY_FILE_VERSION;
+  header.fixedPons = fixedPons;
+  header.numVertices = numVertices;
+  header.numCoreVertices = ponDistribution.size();
+  header.numEdges = numEdges;
+  header.centralServer = centralServer < numVertices ? centralServer 
+          : std::numeric_limits<uint32_t>::max();
+  std::ofstream stream(binFileName.c_str(), std::ios::binary);
+  if (!stream.is_open()) {
+    BOOST_LOG_TRIVIAL(error) << "Topology::saveBinary() - could not open " 
+            << binFileName;
+    return false;
+  }
+  stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (Vertex v = 0; v < numVertices; v++) {
+    TopologyFileVertex record = {topology[v].asid, topology[v].ponCustomers};
+    stream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+  stream.write(reinterpret_cast<const char*>(ponDistribution.data()),
+          ponDistribution.size() * sizeof(TopologyFileCore));
+  // edges are stored by id, see readBinary()
+  for (uint id = 0; id < numEdges; id++) {
+    Edge e = edgeState.edge[id];
+    TopologyFileEdge record;
+    std::memset(&record, 0, sizeof(record));
+    record.source = boost::source(e, topology);
+    record.target = boost::target(e, topology);
+    record.length = topology[e].length;
+    record.maxCapacity = edgeState.maxCapacity[id];
+    record.type = edgeState.type[id];
+    stream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+  stream.close();
+  if (stream.fail()) {
+    BOOST_LOG_TRIVIAL(error) << "Topology::saveBinary() - could not write " 
+            << binFileName;
+    return false;
+  }
+  return true;
+}
+
 VertexVec Topology::getPonNodes() const {
   return ponNodes;
 }
@@ -333,56 +734,41 @@ uint Topology::getPonCustomers(Vertex v) const {
 }
 
 uint Topology::getDistance(uint source, uint dest) const {
-  if (topology[source].ponCustomers > 0) {
-    assert(boost::out_degree(source, topology) == 1);
-    Edge outEdge = *(boost::out_edges(source, topology).first);
-    Vertex mcnode = boost::target(outEdge, topology);
-    return dMap.at(mcnode)[dest] + 1;
-  } else
-    return dMap.at(source)[dest];
+  std::size_t index = (std::size_t) accessNode[source] * numCoreVertices + accessNode[dest];
+  uint distance = distances[index];
+  // unreachable pairs keep the infinite distance set by dijkstra_shortest_paths
+  if (distance == std::numeric_limits<uint>::max())
+    return distance;
+  // the PON edge towards the destination is part of its shortest path tree
+  if (topology[dest].ponCustomers > 0)
+    distance += topology[downEdges[dest]].length;
+  if (topology[source].ponCustomers > 0)
+    distance += 1;
+  return distance;
 }
 
-std::vector<Edge> Topology::getRoute(uint source, uint dest) {
-  VertexVec visitedNodes;
-  std::vector<Edge> route;
-  visitedNodes.clear();
-  Vertex currentNode = boost::vertex(dest, topology);
-  Vertex sourceV = boost::vertex(source, topology);
-  if (topology[source].ponCustomers > 0) {
-    // as ONU nodes have no pMap entry, we need to go to the metro/core node and 
-    // route from there. Incidentally, this also solves the issue with users
-    // on the same PON exchanging data (the route goes to the m/c node as it 
-    // should)
-    // NOTE: as the graph is not bidirectedS, in_edges is not available
-    assert(boost::out_degree(source, topology) == 1);
-    Edge outEdge = *(boost::out_edges(source, topology).first);
-    sourceV = boost::target(outEdge, topology);
-  }
-  
-  while (currentNode != sourceV) {
-    visitedNodes.push_back(currentNode);
-    currentNode = pMap[sourceV][currentNode];
-  }
-  visitedNodes.push_back(sourceV);
-  if (topology[source].ponCustomers > 0)
-    visitedNodes.push_back(source);
-  // Walk back through the visited nodes and record the edges in the right order
-  std::pair<Edge, bool> returnValue;
-  for (VertexVec::reverse_iterator rvIt = visitedNodes.rbegin(); 
-          rvIt+1 != visitedNodes.rend(); rvIt++) {
-    returnValue = boost::edge(*rvIt, *(rvIt+1), topology);
-    // assert(returnValue.second == true);
-    if (!returnValue.second) {
-      std::cerr << "Topology::getRoute() - Failed to retrieve edge from Vertex "
-              << *(rvIt-1) << " to Vertex " << *rvIt << std::endl;
-      exit(ERR_FAILED_ROUTING);
-    }
-    route.push_back(returnValue.first);
+Route Topology::getRoute(uint source, uint dest) const {
+  /* PON nodes have no entry in the route table: we go to their metro/core node
+   * and route from there. Incidentally, this also solves the issue with users
+   * on the same PON exchanging data (the route goes to the m/c node as it 
+   * should)
+   */
+  Vertex sourceV = accessNode[source];
+  Vertex destV = accessNode[dest];
+  std::size_t index = (std::size_t) sourceV * numCoreVertices + destV;
+  uint begin = routeOffsets[index];
+  uint size = routeOffsets[index+1] - begin;
+  if (size == 0 && sourceV != destV) {
+    std::cerr << "Topology::getRoute() - Failed to retrieve a route from Vertex "
+            << sourceV << " to Vertex " << destV << std::endl;
+    exit(ERR_FAILED_ROUTING);
   }
-  return route;
+  return Route(routeEdges.data() + begin, size, 
+          source != sourceV ? &upEdges[source] : nullptr,
+          dest != destV ? &downEdges[dest] : nullptr);
 }
 
-Vertex Topology::getCentralServer() {
+Vertex Topology::getCentralServer() const {
   return centralServer;
 }
 
@@ -396,19 +782,57 @@ void Topology::updateCapacity(Flow* flow, Scheduler* scheduler,
   // we should be able to get in Mbps!
   Capacity MaxBwAchievable = std::min(flow->getChunkSize(), MAX_FLOW_SPEED);
   SimTime now = scheduler->getSimTime();
-  std::vector<Edge> flowRoute = this->getRoute(flow->getSource(), 
-          flow->getDestination());
+  const Route& flowRoute = flow->getRoute();
+  if (addNotRemove)
+    this->linkFlow(flow);
+  else
+    this->unlinkFlow(flow);
+  if (this->maxMinFair && addNotRemove) {
+    bool limited = false;
+    BOOST_FOREACH (Edge e, flowRoute) {
+      if (edgeState.maxCapacity[topology[e].id] != UNLIMITED)
+        limited = true;
+    }
+    if (!limited) {
+      // no edge can constrain this flow, nor can it constrain any other flow
+      flow->setBandwidth(MaxBwAchievable);
+      this->updateEta(flow, scheduler);
+      return;
+    }
+  }
+  if (this->batchMode) {
+    // only keep track of the flows on each edge, bandwidth is reallocated in endBatch()
+    BOOST_FOREACH (Edge e, flowRoute) {
+      uint id = topology[e].id;
+      if (!addNotRemove && edgeState.maxCapacity[id] != UNLIMITED) {
+        edgeState.spareCapacity[id] += flow->getBandwidth();
+        this->updateCongestion(id);
+      }
+      dirtyEdges.insert(id);
+    }
+    return;
+  }
+  if (this->maxMinFair) {
+    fairShare.seeds.clear();
+    BOOST_FOREACH (Edge e, flowRoute) {
+      fairShare.seeds.push_back(topology[e].id);
+    }
+    // a removed flow is no longer on any edge, so its bandwidth is released
+    // when the spare capacity of the affected edges is recomputed
+    this->reallocateMaxMinFair(fairShare.seeds, scheduler);
+    return;
+  }
   Capacity minSpareCapacity(UNLIMITED), minCut(UNLIMITED), maxBneckBw(UNLIMITED);
-  Edge bottleneck = flowRoute.back();
+  uint bottleneck = topology[flowRoute.back()].id;
   if (addNotRemove) {
     // new flow, traverse route to determine minSpareCapacity and minCut
     BOOST_FOREACH (Edge e, flowRoute) {
-      topology[e].activeFlows.insert(flow);
-      minSpareCapacity = std::min(minSpareCapacity, topology[e].spareCapacity);
-      if (topology[e].maxCapacity != UNLIMITED && 
-            topology[e].maxCapacity / topology[e].activeFlows.size() < minCut) {
-        minCut = topology[e].maxCapacity / topology[e].activeFlows.size();
-        bottleneck = e;
+      uint id = topology[e].id;
+      minSpareCapacity = std::min(minSpareCapacity, edgeState.spareCapacity[id]);
+      if (edgeState.maxCapacity[id] != UNLIMITED && 
+            edgeState.maxCapacity[id] / edgeState.activeFlows[id].size() < minCut) {
+        minCut = edgeState.maxCapacity[id] / edgeState.activeFlows[id].size();
+        bottleneck = id;
       }
     }
     if (minSpareCapacity >= MaxBwAchievable) {
@@ -428,9 +852,10 @@ void Topology::updateCapacity(Flow* flow, Scheduler* scheduler,
       this->updateRouteCapacity(flowRoute, -minCut);
       this->updateEta(flow, scheduler);
       // reduce bw to other flows to match link capacity constraints
-      BOOST_FOREACH(Flow* f, topology[bottleneck].activeFlows) {
+      BOOST_FOREACH(EdgeLink& link, edgeState.activeFlows[bottleneck]) {
+        Flow* f = link.flow;
         if (f->getBandwidth() > minCut) {
-          this->updateRouteCapacity(this->getRoute(f->getSource(), f->getDestination()),
+          this->updateRouteCapacity(f->getRoute(),
                   f->getBandwidth() - minCut);
           f->updateSizeDownloaded(now);
           f->setBandwidth(minCut);
@@ -438,10 +863,11 @@ void Topology::updateCapacity(Flow* flow, Scheduler* scheduler,
         }
       }
       // we need this check to account for rounding errors. 
-      if (topology[bottleneck].spareCapacity < 0) {
+      if (edgeState.spareCapacity[bottleneck] < 0) {
         // std::cerr << "WARNING: Topology::updateCapacity() - negative spareCapacity ("
-        //        << topology[bottleneck].spareCapacity << std::endl;
-        topology[bottleneck].spareCapacity = 0;
+        //        << edgeState.spareCapacity[bottleneck] << std::endl;
+        edgeState.spareCapacity[bottleneck] = 0;
+        this->updateCongestion(bottleneck);
       }
     }
   }
@@ -451,20 +877,21 @@ void Topology::updateCapacity(Flow* flow, Scheduler* scheduler,
     // enough spare capacity on other links.
     // free bw across the route and check how much bw are other flows consuming
     BOOST_FOREACH(Edge e, flowRoute) {
-      topology[e].activeFlows.erase(flow);
+      uint id = topology[e].id;
       // if this link has infinite capacity, we're done here
-      if (topology[e].maxCapacity != UNLIMITED) {
-        topology[e].spareCapacity += flow->getBandwidth();
+      if (edgeState.maxCapacity[id] != UNLIMITED) {
+        edgeState.spareCapacity[id] += flow->getBandwidth();
+        this->updateCongestion(id);
+        uint numFlows = edgeState.activeFlows[id].size();
         // minCut is the minimum (across links) of the average bw of impacted flows 
-        if (topology[e].activeFlows.size() > 0)
-          minCut = std::min(minCut, (topology[e].maxCapacity - topology[e].spareCapacity)
-                / topology[e].activeFlows.size());
+        if (numFlows > 0)
+          minCut = std::min(minCut, (edgeState.maxCapacity[id] - edgeState.spareCapacity[id])
+                / numFlows);
         // maxBneckBw is the maximum bw a flow can get with fair sharing on the
         // bottleneck for the removed flow route
-        if (topology[e].activeFlows.size() > 0 &&
-                topology[e].maxCapacity / topology[e].activeFlows.size() < maxBneckBw) {
-          maxBneckBw = topology[e].maxCapacity / topology[e].activeFlows.size();
-          bottleneck = e;
+        if (numFlows > 0 && edgeState.maxCapacity[id] / numFlows < maxBneckBw) {
+          maxBneckBw = edgeState.maxCapacity[id] / numFlows;
+          bottleneck = id;
         }
       }
     }
@@ -478,18 +905,18 @@ void Topology::updateCapacity(Flow* flow, Scheduler* scheduler,
       if (std::floor(maxBneckBw) > 0)
         maxBneckBw = std::floor(maxBneckBw);
       maxBneckBw = std::min (MAX_FLOW_SPEED, maxBneckBw); 
-      std::vector<Edge> fRoute;
-      BOOST_FOREACH (Flow* f, topology[bottleneck].activeFlows) {
+      BOOST_FOREACH (EdgeLink& link, edgeState.activeFlows[bottleneck]) {
+        Flow* f = link.flow;
         // check if there's room to increase this flow bw (basing only on the
         // removed flow bottleneck, hence not optimal as the previous method)
         // remember that we can only get the chunk's size worth of bw
         MaxBwAchievable = std::min(f->getChunkSize(), maxBneckBw);
         Capacity increase = MaxBwAchievable - f->getBandwidth();
         if (increase > this->minFlowIncrease) {
-          fRoute = this->getRoute(f->getSource(), f->getDestination());
+          const Route& fRoute = f->getRoute();
           bool safeToGrow = true;
           BOOST_FOREACH (Edge e, fRoute) {
-            if (topology[e].spareCapacity <= increase ) {
+            if (edgeState.spareCapacity[topology[e].id] <= increase ) {
               safeToGrow = false;
               break;
             }
@@ -500,24 +927,268 @@ void Topology::updateCapacity(Flow* flow, Scheduler* scheduler,
             f->updateSizeDownloaded(now);
             f->setBandwidth(MaxBwAchievable);
             // this if clause was added to prevent a failed assertion due to flows carried over from previous rounds
-            if (now <= scheduler->getRoundDuration())
+            if (now <= scheduler->getRoundStart() + scheduler->getRoundDuration())
               this->updateEta(f, scheduler);
           }
-          fRoute.clear();
         }
       }
       // we need this check to account for rounding errors. 
-      if (topology[bottleneck].spareCapacity < 0) {
+      if (edgeState.spareCapacity[bottleneck] < 0) {
         // std::cerr << "WARNING: Topology::updateCapacity() - negative spareCapacity ("
-        //        << topology[bottleneck].spareCapacity << std::endl;
-        topology[bottleneck].spareCapacity = 0;
+        //        << edgeState.spareCapacity[bottleneck] << std::endl;
+        edgeState.spareCapacity[bottleneck] = 0;
+        this->updateCongestion(bottleneck);
       }
     }
   }
 } 
 
-bool loadCompare(LoadMap::value_type &i1, LoadMap::value_type &i2) {
-  return i1.second < i2.second;
+void Topology::linkFlow(Flow* flow) {
+  uint pos = 0;
+  BOOST_FOREACH (Edge e, flow->getRoute()) {
+    uint id = topology[e].id;
+    edgeState.activeFlows[id].push_back(flow->getEdgeLink(pos++));
+    this->updateCongestion(id);
+  }
+}
+
+void Topology::unlinkFlow(Flow* flow) {
+  uint pos = 0;
+  BOOST_FOREACH (Edge e, flow->getRoute()) {
+    uint id = topology[e].id;
+    FlowList& flows = edgeState.activeFlows[id];
+    flows.erase(flows.iterator_to(flow->getEdgeLink(pos++)));
+    this->updateCongestion(id);
+  }
+}
+
+void Topology::beginBatch() {
+  this->batchMode = true;
+}
+
+void Topology::endBatch(Scheduler* scheduler) {
+  this->batchMode = false;
+  if (dirtyEdges.empty())
+    return;
+  if (this->maxMinFair) {
+    fairShare.seeds.assign(dirtyEdges.begin(), dirtyEdges.end());
+    dirtyEdges.clear();
+    this->reallocateMaxMinFair(fairShare.seeds, scheduler);
+    return;
+  }
+  SimTime now = scheduler->getSimTime();
+  // collect all the flows sharing an edge with those added or removed
+  std::set<Flow*> flowSet;
+  BOOST_FOREACH (uint id, dirtyEdges) {
+    BOOST_FOREACH (EdgeLink& link, edgeState.activeFlows[id]) {
+      flowSet.insert(link.flow);
+    }
+  }
+  dirtyEdges.clear();
+  // compute the fair share of each flow across its route
+  std::vector<std::pair<Flow*, Capacity> > shares;
+  shares.reserve(flowSet.size());
+  BOOST_FOREACH (Flow* f, flowSet) {
+    Capacity share = std::min(f->getChunkSize(), MAX_FLOW_SPEED);
+    BOOST_FOREACH (Edge e, f->getRoute()) {
+      uint id = topology[e].id;
+      if (edgeState.maxCapacity[id] != UNLIMITED)
+        share = std::min(share, edgeState.maxCapacity[id] / edgeState.activeFlows[id].size());
+    }
+    // rounding to prevent capacity overflow, but need to ensure that we
+    // don't round to 0!
+    if (std::floor(share) > 0)
+      share = std::floor(share);
+    shares.push_back(std::make_pair(f, share));
+  }
+  // reduce the flows which are above their share first, to make room...
+  for (uint i = 0; i < shares.size(); i++) {
+    Flow* f = shares[i].first;
+    if (f->getBandwidth() > shares[i].second) {
+      const Route& fRoute = f->getRoute();
+      this->updateRouteCapacity(fRoute, f->getBandwidth() - shares[i].second);
+      f->updateSizeDownloaded(now);
+      f->setBandwidth(shares[i].second);
+      this->updateEta(f, scheduler);
+    }
+  }
+  // ...then grow the others as far as the spare capacity allows, starting from
+  // the flows with the lowest bandwidth (i.e., the new ones)
+  std::stable_sort(shares.begin(), shares.end(), 
+          [](const std::pair<Flow*, Capacity>& a, const std::pair<Flow*, Capacity>& b) {
+            return a.first->getBandwidth() < b.first->getBandwidth();
+          });
+  for (uint i = 0; i < shares.size(); i++) {
+    Flow* f = shares[i].first;
+    Capacity increase = shares[i].second - f->getBandwidth();
+    if (increase <= 0 || (f->getBandwidth() > 0 && increase <= this->minFlowIncrease))
+      continue;
+    const Route& fRoute = f->getRoute();
+    BOOST_FOREACH (Edge e, fRoute) {
+      uint id = topology[e].id;
+      if (edgeState.maxCapacity[id] != UNLIMITED)
+        increase = std::min(increase, edgeState.spareCapacity[id]);
+    }
+    // a new flow must get some bandwidth, even if rounding errors ate up the spare capacity
+    if (f->getBandwidth() == 0 && increase <= 0)
+      increase = shares[i].second;
+    if (increase > 0) {
+      this->updateRouteCapacity(fRoute, -increase);
+      f->updateSizeDownloaded(now);
+      f->setBandwidth(f->getBandwidth() + increase);
+      this->updateEta(f, scheduler);
+      // we need this check to account for rounding errors
+      BOOST_FOREACH (Edge e, fRoute) {
+        uint id = topology[e].id;
+        if (edgeState.spareCapacity[id] < 0) {
+          edgeState.spareCapacity[id] = 0;
+          this->updateCongestion(id);
+        }
+      }
+    }
+  }
+}
+
+void Topology::reallocateMaxMinFair(const std::vector<uint>& seeds, 
+        Scheduler* scheduler) {
+  SimTime now = scheduler->getSimTime();
+  FairShareState& fs = this->fairShare;
+  /* Collect the connected component of capacity-limited edges and flows 
+   * reachable from the seeds: every flow on an edge of the component is part of
+   * it, and so is every capacity-limited edge on the route of such a flow. 
+   * Flows and edges outside the component keep their allocation, which is 
+   * still max-min fair since none of their constraints changed.
+   */
+  fs.edges.clear();
+  fs.flows.clear();
+  // flows stamped by previous reallocations are not part of this component
+  fs.stamp++;
+  BOOST_FOREACH (uint id, seeds) {
+    if (edgeState.maxCapacity[id] != UNLIMITED && fs.edgeSlot[id] == std::numeric_limits<uint>::max()) {
+      fs.edgeSlot[id] = fs.edges.size();
+      fs.edges.push_back(id);
+    }
+  }
+  // fs.edges grows while we visit it, breadth-first
+  for (uint i = 0; i < fs.edges.size(); i++) {
+    BOOST_FOREACH (EdgeLink& link, edgeState.activeFlows[fs.edges[i]]) {
+      Flow* f = link.flow;
+      if (f->fairShareStamp == fs.stamp)
+        continue;
+      f->fairShareStamp = fs.stamp;
+      f->fairShareSlot = fs.flows.size();
+      fs.flows.push_back(f);
+      BOOST_FOREACH (Edge e, f->getRoute()) {
+        uint id = topology[e].id;
+        if (edgeState.maxCapacity[id] != UNLIMITED && fs.edgeSlot[id] == std::numeric_limits<uint>::max()) {
+          fs.edgeSlot[id] = fs.edges.size();
+          fs.edges.push_back(id);
+        }
+      }
+    }
+  }
+  const uint numEdges = fs.edges.size(), numFlows = fs.flows.size();
+  /* Progressive filling: all the unfrozen flows grow at the same pace; a flow 
+   * is frozen when it reaches its maximum rate, or when one of its edges is 
+   * saturated, in which case all the unfrozen flows on that edge are frozen.
+   * The next flow to reach its maximum rate is found by scanning the flows by
+   * increasing demand, and the next edge to be saturated is the one with the
+   * lowest fair share in a heap, so each flow and each edge is only visited a
+   * constant number of times (plus the heap operations).
+   */
+  fs.remaining.resize(numEdges);
+  fs.unfrozen.resize(numEdges);
+  fs.heap.clear();
+  for (uint i = 0; i < numEdges; i++) {
+    fs.remaining[i] = edgeState.maxCapacity[fs.edges[i]];
+    fs.unfrozen[i] = edgeState.activeFlows[fs.edges[i]].size();
+    if (fs.unfrozen[i] > 0)
+      fs.heap.push_back(std::make_pair(fs.remaining[i] / fs.unfrozen[i], i));
+  }
+  std::make_heap(fs.heap.begin(), fs.heap.end(), 
+          std::greater<std::pair<Capacity, uint> >());
+  fs.demand.resize(numFlows);
+  fs.allocation.assign(numFlows, 0);
+  fs.frozen.assign(numFlows, false);
+  fs.byDemand.resize(numFlows);
+  for (uint j = 0; j < numFlows; j++) {
+    fs.demand[j] = std::min(fs.flows[j]->getChunkSize(), MAX_FLOW_SPEED);
+    fs.byDemand[j] = j;
+  }
+  std::sort(fs.byDemand.begin(), fs.byDemand.end(), [&fs](uint a, uint b) {
+    return fs.demand[a] < fs.demand[b];
+  });
+  // freezes a flow, releasing the edges of its route from its allocation
+  auto freeze = [this, &fs](uint j, Capacity allocation) {
+    fs.frozen[j] = true;
+    fs.allocation[j] = allocation;
+    BOOST_FOREACH (Edge e, fs.flows[j]->getRoute()) {
+      uint slot = fs.edgeSlot[topology[e].id];
+      if (slot == std::numeric_limits<uint>::max())
+        continue;
+      fs.remaining[slot] -= allocation;
+      if (--fs.unfrozen[slot] > 0) {
+        fs.heap.push_back(std::make_pair(fs.remaining[slot] / fs.unfrozen[slot], slot));
+        std::push_heap(fs.heap.begin(), fs.heap.end(), 
+                std::greater<std::pair<Capacity, uint> >());
+      }
+    }
+  };
+  const Capacity epsilon = 1e-9;
+  uint next = 0;
+  while (true) {
+    // skip the stale entries, whose edge changed share since they were pushed
+    while (!fs.heap.empty()) {
+      uint slot = fs.heap.front().second;
+      if (fs.unfrozen[slot] > 0 && 
+              fs.heap.front().first == fs.remaining[slot] / fs.unfrozen[slot])
+        break;
+      std::pop_heap(fs.heap.begin(), fs.heap.end(), 
+              std::greater<std::pair<Capacity, uint> >());
+      fs.heap.pop_back();
+    }
+    while (next < numFlows && fs.frozen[fs.byDemand[next]])
+      next++;
+    if (next == numFlows)
+      break;
+    uint j = fs.byDemand[next];
+    if (fs.heap.empty() || fs.demand[j] <= fs.heap.front().first + epsilon) {
+      // the flow reaches its maximum rate before any of its edges saturates
+      freeze(j, fs.demand[j]);
+      continue;
+    }
+    // the edge is saturated, so all its unfrozen flows get its fair share
+    Capacity level = std::max(fs.heap.front().first, 0.0);
+    uint slot = fs.heap.front().second;
+    std::pop_heap(fs.heap.begin(), fs.heap.end(), 
+            std::greater<std::pair<Capacity, uint> >());
+    fs.heap.pop_back();
+    BOOST_FOREACH (EdgeLink& link, edgeState.activeFlows[fs.edges[slot]]) {
+      uint k = link.flow->fairShareSlot;
+      if (!fs.frozen[k])
+        freeze(k, std::min(level, fs.demand[k]));
+    }
+  }
+  // apply the new allocation
+  for (uint j = 0; j < numFlows; j++) {
+    Flow* f = fs.flows[j];
+    if (f->getBandwidth() == fs.allocation[j])
+      continue;
+    f->updateSizeDownloaded(now);
+    f->setBandwidth(fs.allocation[j]);
+    this->updateEta(f, scheduler);
+  }
+  BOOST_FOREACH (uint id, fs.edges) {
+    Capacity usedBw = 0;
+    BOOST_FOREACH (EdgeLink& link, edgeState.activeFlows[id]) {
+      usedBw += link.flow->getBandwidth();
+    }
+    edgeState.spareCapacity[id] = std::max(edgeState.maxCapacity[id] - usedBw, 0.0);
+    edgeState.peakCapacity[id] = std::max(edgeState.peakCapacity[id], 
+            std::min(usedBw, edgeState.maxCapacity[id]));
+    this->updateCongestion(id);
+    fs.edgeSlot[id] = std::numeric_limits<uint>::max();
+  }
 }
 
 void Topology::printNetworkStats(uint currentRound, uint roundDuration) {
@@ -530,16 +1201,17 @@ void Topology::printNetworkStats(uint currentRound, uint roundDuration) {
    * capacity, peakCoreEdge would otherwise be returned as an undefined variable
    * in the previous implementation.
    */
-  Edge nullE = *(boost::edges(topology).first) ;
+  Edge nullE = edgeState.edge.front();
   Edge maxEdge(nullE), peakAccessUpEdge(nullE), peakAccessDownEdge(nullE), 
           peakCoreEdge(nullE), peakMetroEdge(nullE);
   uint numAccessEdges = (numEdges - (numCoreEdges + numMetroEdges)) / 2;
-  BOOST_FOREACH (Edge e, boost::edges(topology)) {
-    if (loadMap[e] > 0) {
-      temp = loadMap[e] / roundDuration;
-      tempPeak = topology[e].peakCapacity;
+  for (uint id = 0; id < edgeState.edge.size(); id++) {
+    if (edgeState.load[id] > 0) {
+      Edge e = edgeState.edge[id];
+      temp = edgeState.load[id] / roundDuration;
+      tempPeak = edgeState.peakCapacity[id];
       averageTot += temp;
-      if (this->getEdgeType(e) == CORE) {
+      if (edgeState.type[id] == CORE) {
         averageCore += temp;
         avgPeakCore += tempPeak;
         if (tempPeak > peakCore) {
@@ -547,7 +1219,7 @@ void Topology::printNetworkStats(uint currentRound, uint roundDuration) {
           peakCoreEdge = e;
         }
       }
-      else if (this->getEdgeType(e) == METRO) {
+      else if (edgeState.type[id] == METRO) {
         averageMetro += temp;
         avgPeakMetro += tempPeak;
         if (tempPeak > peakMetro) {
@@ -555,7 +1227,7 @@ void Topology::printNetworkStats(uint currentRound, uint roundDuration) {
           peakMetroEdge = e;
         }
       }
-      else if (this->getEdgeType(e) == UPSTREAM) {
+      else if (edgeState.type[id] == UPSTREAM) {
         averageAccessUp += temp;
         avgPeakAccessUp += tempPeak;
         if (tempPeak > peakAccessUp) {
@@ -563,7 +1235,7 @@ void Topology::printNetworkStats(uint currentRound, uint roundDuration) {
           peakAccessUpEdge = e;
         }
       }
-      else if (this->getEdgeType(e) == DOWNSTREAM) {
+      else if (edgeState.type[id] == DOWNSTREAM) {
         averageAccessDown += temp;
         avgPeakAccessDown += tempPeak;
         if (tempPeak > peakAccessDown) {
@@ -638,73 +1310,98 @@ void Topology::printNetworkStats(uint currentRound, uint roundDuration) {
  * from previous round.
  */
 void Topology::resetLoadMap() {
-  BOOST_FOREACH(Edge e, boost::edges(topology)) {
-    loadMap.at(e) = 0;
-  }
+  std::fill(edgeState.load.begin(), edgeState.load.end(), 0);
 }
 
 void Topology::resetFlows() {
-  BOOST_FOREACH(Edge e, boost::edges(topology)) {
-    topology[e].spareCapacity = topology[e].maxCapacity;
-    topology[e].activeFlows.clear();
+  edgeState.spareCapacity = edgeState.maxCapacity;
+  BOOST_FOREACH(FlowList& flows, edgeState.activeFlows) {
+    flows.clear();
   }
+  for (uint id = 0; id < edgeState.edge.size(); id++)
+    this->updateCongestion(id);
 }
 
 void Topology::updateLoadMap(Flow* flow) {
   Capacity cSize = flow->getSizeDownloaded();
-  BOOST_FOREACH(Edge e, this->getRoute(flow->getSource(), flow->getDestination())){
-    loadMap[e] += cSize;
+  BOOST_FOREACH(Edge e, flow->getRoute()) {
+    edgeState.load[topology[e].id] += cSize;
   }  
 }
 
-bool Topology::isLocal(Vertex source, Vertex dest) {
+bool Topology::isLocal(Vertex source, Vertex dest) const {
   return (topology[source].asid == topology[dest].asid);
 }
 
-Vertex Topology::getLocalCache(Vertex node) {
+Vertex Topology::getLocalCache(Vertex node) const {
   return this->asCacheMap.at(topology[node].asid);
 }
 
-VertexVec Topology::getLocalCacheNodes() {
+VertexVec Topology::getLocalCacheNodes() const {
   VertexVec cacheNodes;
-  for (VertexMap::iterator it = asCacheMap.begin(); it != asCacheMap.end(); it++) {
+  for (VertexMap::const_iterator it = asCacheMap.begin(); it != asCacheMap.end(); it++) {
     cacheNodes.push_back(it->second);
   }
   return cacheNodes;
 }
 
 // Checks whether adding a new flow would reduce QoE below the minimal threshold
-bool Topology::isCongested(PonUser source, PonUser destination) {
-  std::vector<Edge> route = this->getRoute(source, destination);
-  bool congested = false;
+bool Topology::isCongested(PonUser source, PonUser destination) const {
+  // the PON edges are the usual bottleneck, and they only take a bit test
+  if ((ponCongestion[source.first] & PON_UP_CONGESTED) ||
+          (ponCongestion[destination.first] & PON_DOWN_CONGESTED))
+    return true;
+  if (numCongestedCore == 0)
+    return false;
+  Route route = this->getRoute(source, destination);
   BOOST_FOREACH (Edge e, route) {
-    if (topology[e].maxCapacity != UNLIMITED && 
-        topology[e].spareCapacity < this->bitrate &&
-        topology[e].maxCapacity / (topology[e].activeFlows.size()+1) < this->bitrate) {
-      congested = true;
+    if (edgeState.congested[topology[e].id])
+      return true;
+  }
+  return false;
+}
+
+void Topology::updateCongestion(uint id) {
+  bool congested = edgeState.maxCapacity[id] != UNLIMITED && 
+          edgeState.spareCapacity[id] < this->bitrate &&
+          edgeState.maxCapacity[id] / (edgeState.activeFlows[id].size()+1) < this->bitrate;
+  if (congested == edgeState.congested[id])
+    return;
+  edgeState.congested[id] = congested;
+  switch (edgeState.type[id]) {
+    case UPSTREAM:
+      ponCongestion[boost::source(edgeState.edge[id], topology)] ^= PON_UP_CONGESTED;
       break;
-    }
+    case DOWNSTREAM:
+      ponCongestion[boost::target(edgeState.edge[id], topology)] ^= PON_DOWN_CONGESTED;
+      break;
+    default:
+      if (congested)
+        numCongestedCore++;
+      else
+        numCongestedCore--;
   }
-  return congested;
 }
 
 // checks what kind of link this is (see EdgeType definition)
 EdgeType Topology::getEdgeType(Edge e) const{
-    return topology[e].type;
+    return edgeState.type[topology[e].id];
 }
 
-void Topology::updateRouteCapacity(std::vector<Edge> route, Capacity toAdd) {
+void Topology::updateRouteCapacity(const Route& route, Capacity toAdd) {
   BOOST_FOREACH(Edge e, route) {
+    uint id = topology[e].id;
     // Note: because of this check, capacity is actually unlimited, but
     // the peakCapacity is not recorded for unlimited bw links.
-    if (topology[e].maxCapacity != UNLIMITED) {
-      topology[e].spareCapacity += toAdd;
+    if (edgeState.maxCapacity[id] != UNLIMITED) {
+      edgeState.spareCapacity[id] += toAdd;
+      this->updateCongestion(id);
       // update peakCapacity if need be
       if (toAdd < 0) {
-        Capacity usedBw = std::min(topology[e].maxCapacity - topology[e].spareCapacity,
-            topology[e].maxCapacity);
-        if (usedBw > topology[e].peakCapacity)
-          topology[e].peakCapacity = usedBw;
+        Capacity usedBw = std::min(edgeState.maxCapacity[id] - edgeState.spareCapacity[id],
+            edgeState.maxCapacity[id]);
+        if (usedBw > edgeState.peakCapacity[id])
+          edgeState.peakCapacity[id] = usedBw;
       }
     }
   }
@@ -716,12 +1413,17 @@ void Topology::updateEta(Flow* flow, Scheduler* scheduler) {
    */
   SimTime downloadEta, oldEta(flow->getEta());
   SimTime now = scheduler->getSimTime();  
-  downloadEta = now + std::floor(((flow->getChunkSize() - flow->getSizeDownloaded())
-          / flow->getBandwidth()) + 0.5);
-  flow->setEta(downloadEta);
-  // Ensure that at least 1 second of flow is simulated
-  if (flow->getEta() <= flow->getStart())
-    flow->setEta(flow->getStart() + 1);
+  if (flow->getBandwidth() <= 0) {
+    // e.g. a zero capacity edge on its route, the flow stalls until it gets some bandwidth
+    flow->setEta(INF_TIME);
+  } else {
+    downloadEta = now + std::floor(((flow->getChunkSize() - flow->getSizeDownloaded())
+            / flow->getBandwidth()) + 0.5);
+    flow->setEta(downloadEta);
+    // Ensure that at least 1 second of flow is simulated
+    if (flow->getEta() <= flow->getStart())
+      flow->setEta(flow->getStart() + 1);
+  }
   assert(flow->getEta() >= now);
   if (flow->getEta() != oldEta) {
     scheduler->updateSchedule(flow, oldEta);
@@ -730,19 +1432,6 @@ void Topology::updateEta(Flow* flow, Scheduler* scheduler) {
   }
 }
 
-/* Prints a snapshot of the network topology in graphml format, so that it can
- * be visualized through third party tools such as Gephi
- */
 void Topology::printTopology(SimTime time, uint round) {
-  std::ofstream outG;
-  std::string index = boost::lexical_cast<std::string, uint>(round) + "_" +
-          boost::lexical_cast<std::string, uint>(time);
-  std::string filename = "./topologies/out_" + index + ".graphml";
-  outG.open(filename);
-  if (!outG.is_open()) {
-    BOOST_LOG_TRIVIAL(error) << "could not open output graph file " << filename;
-    abort();
-  }  
-  boost::write_graphml(outG, topology, snapDp);
-  outG.close();  
-}
\ No newline at end of file
+  snapshotWriter->capture(time, round, edgeState);
+}
@@ -10,17 +10,21 @@
 
 #include "ContentElement.hpp"
 #include <string>
+#include <cstdint>
 #include "boost/graph/adjacency_list.hpp"
 #include "boost/graph/graph_traits.hpp"
 #include <vector>
 #include <map>
 #include <set>
 #include <fstream>
+#include <iterator>
 #include <boost/property_map/dynamic_property_map.hpp>
+#include "boost/intrusive/list.hpp"
 
 // forward declarations to avoid include circles
 class Scheduler;
 class Flow;
+class SnapshotWriter;
 
 using std::string;
 
@@ -31,6 +35,28 @@ using std::string;
  */
 enum EdgeType {UPSTREAM, DOWNSTREAM, METRO, CORE, UNKNOWN_TYPE};
 
+/**
+ * The bits of Topology::ponCongestion, set when the upstream (respectively 
+ * downstream) PON edge of a vertex is congested.
+ */
+const uint8_t PON_UP_CONGESTED = 1;
+const uint8_t PON_DOWN_CONGESTED = 2;
+
+/**
+ * Links a Flow to one of the Edges of its route, so that the Flows active on an
+ * Edge can be kept in an intrusive list without allocating memory. Each Flow 
+ * with a route holds one of them for each position of its route, allocated by
+ * the FlowPool when the route is set.
+ */
+struct EdgeLink : public boost::intrusive::list_base_hook<> {
+  Flow* flow; /**< The Flow this link belongs to. */
+};
+
+/**
+ * The list of Flows active on an Edge, with constant time size().
+ */
+typedef boost::intrusive::list<EdgeLink> FlowList;
+
 /**
  *  A struct used to define bundled properties for nodes in the topology graph.
  */
@@ -41,15 +67,12 @@ struct NetworkNode {
 /**
  * A struct used to define bundled properties for edges in the topology graph.
  * Note that edges are uni-directional, i.e., a link is a composed by a pair
- * of edges with opposite directions.
+ * of edges with opposite directions. The state of the edge during the 
+ * simulation is not stored here, but in the EdgeState of the Topology.
  */
 struct NetworkEdge {
+    uint id; /**< The index of this edge in the vectors of EdgeState. */
     double length; /**< The length of the edge in meters. */
-    Capacity maxCapacity; /**< The maximum bandwidth available on this edge. */
-    Capacity spareCapacity; /**< The amount of bandwidth currently availabe on this edge, i.e., after substracting the capacity already used by Flows transiting on it. */
-    std::set<Flow*> activeFlows; /**< The set of Flows actively using this edge at the moment. */
-    Capacity peakCapacity; /**< The highest bandwidth collectively used by Flows on this edge at any given time in the current simulation round. */
-    EdgeType type; /**< The EdgeType of this edge. Used to differentiate between core, metro and access traffic. */
 };
 
 // Our graph template
@@ -61,11 +84,148 @@ typedef boost::graph_traits<DGraph>::vertex_iterator VertexIterator;
 typedef boost::graph_traits<DGraph>::edge_descriptor Edge;
 typedef boost::graph_traits<DGraph>::edge_iterator EdgeIterator;
 typedef std::vector<Vertex> VertexVec;
-typedef std::map<unsigned int, std::vector<Vertex> > PredecessorMap;
 
 typedef std::map<unsigned int, Vertex> VertexMap;
-typedef std::map<Vertex, std::vector<unsigned int> > DistanceMap;
-typedef std::map<Edge, Capacity> LoadMap;
+
+/**
+ * The state of the edges of the topology, stored as a structure of arrays 
+ * indexed by NetworkEdge::id, so that the loops over the edges of a route or
+ * over the whole topology only touch contiguous memory.
+ */
+struct EdgeState {
+  std::vector<Edge> edge; /**< The descriptor of each edge in the graph. */
+  std::vector<EdgeType> type; /**< The EdgeType of each edge. Used to differentiate between core, metro and access traffic. */
+  std::vector<Capacity> maxCapacity; /**< The maximum bandwidth available on each edge. */
+  std::vector<Capacity> spareCapacity; /**< The amount of bandwidth currently availabe on each edge, i.e., after substracting the capacity already used by Flows transiting on it. */
+  std::vector<Capacity> peakCapacity; /**< The highest bandwidth collectively used by Flows on each edge at any given time in the current simulation round. */
+  std::vector<Capacity> load; /**< The total traffic observed on each edge in the current round. Used to compute the traffic statistics at the end of each round. */
+  std::vector<FlowList> activeFlows; /**< The Flows actively using each edge at the moment. */
+  std::vector<bool> congested; /**< True for the edges which could not take one more Flow at the content bitrate. Kept up to date by Topology::updateCongestion() whenever spareCapacity or activeFlows change. */
+};
+
+/**
+ * The working state of Topology::reallocateMaxMinFair(), kept across calls so
+ * that reallocating bandwidth after an event does not allocate any memory once
+ * the buffers have grown to the size of the largest component. The Edges and 
+ * Flows of the component being reallocated are assigned consecutive slots, 
+ * and the per-slot vectors are indexed by them.
+ */
+struct FairShareState {
+  std::vector<uint> edgeSlot; /**< For each edge id, its slot in the current component, or the maximum uint if it is not part of it. Reset for the edges of the component at the end of each reallocation. */
+  uint64_t stamp; /**< The number of reallocations so far; a Flow belongs to the current component if its Flow::fairShareStamp matches it, in which case Flow::fairShareSlot is its slot. */
+  std::vector<uint> seeds; /**< The edges whose Flows changed, from which the component is collected. */
+  std::vector<uint> edges; /**< The id of the edge in each edge slot. */
+  std::vector<Capacity> remaining; /**< The capacity of each edge slot not yet assigned to frozen Flows. */
+  std::vector<uint> unfrozen; /**< The number of Flows of each edge slot which are not frozen yet. */
+  std::vector<Flow*> flows; /**< The Flow in each flow slot. */
+  std::vector<Capacity> demand; /**< The highest bandwidth each flow slot can get, i.e., the lowest of MAX_FLOW_SPEED and its chunk size. */
+  std::vector<Capacity> allocation; /**< The bandwidth assigned to each flow slot when it is frozen. */
+  std::vector<bool> frozen; /**< True for the flow slots whose allocation is final. */
+  std::vector<uint> byDemand; /**< The flow slots sorted by increasing demand. */
+  std::vector<std::pair<Capacity, uint> > heap; /**< A min-heap of the fair share of the edge slots; an entry is stale if the share of its slot has changed since it was pushed. */
+};
+
+/**
+ * A non-owning view of the sequence of Edges composing the shortest route 
+ * between two vertices. The metro/core part of the route points into the route
+ * table of the Topology, while the PON edges at either end (if any) are stored
+ * in the Route itself; hence a Route can be retrieved and copied without 
+ * allocating any memory. It remains valid as long as the Topology it came from.
+ */
+class Route {
+public:
+  /**
+   * Forward iterator over the Edges of a Route, from the source to the destination.
+   */
+  class const_iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Edge value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Edge* pointer;
+    typedef Edge reference;
+
+    const_iterator() : route(nullptr), pos(0) {}
+    const_iterator(const Route* route, uint pos) : route(route), pos(pos) {}
+    Edge operator*() const {
+      return route->at(pos);
+    }
+    const_iterator& operator++() {
+      pos++;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator old(*this);
+      pos++;
+      return old;
+    }
+    bool operator==(const const_iterator& other) const {
+      return pos == other.pos && route == other.route;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+  private:
+    const Route* route;
+    uint pos;
+  };
+  typedef const_iterator iterator;
+
+  Route() : core(nullptr), coreSize(0), hasFirst(false), hasLast(false) {}
+  /**
+   * Builds a Route from its core part and its (optional) access edges.
+   * @param core A pointer to the first Edge of the metro/core part of the route.
+   * @param coreSize The number of Edges in the metro/core part of the route.
+   * @param first The upstream PON Edge of the source, or nullptr if the source is not a PON.
+   * @param last The downstream PON Edge of the destination, or nullptr if the destination is not a PON.
+   */
+  Route(const Edge* core, uint coreSize, const Edge* first, const Edge* last) :
+    core(core), coreSize(coreSize), hasFirst(first != nullptr), 
+    hasLast(last != nullptr) {
+    if (hasFirst)
+      this->first = *first;
+    if (hasLast)
+      this->last = *last;
+  }
+  /**
+   * Retrieves the i-th Edge of the Route, starting from the source.
+   * @param i The position of the Edge in the Route, which must be lower than size().
+   * @return The i-th Edge of the Route.
+   */
+  Edge at(uint i) const {
+    if (hasFirst) {
+      if (i == 0)
+        return first;
+      i--;
+    }
+    if (i < coreSize)
+      return core[i];
+    return last;
+  }
+  uint size() const {
+    return coreSize + hasFirst + hasLast;
+  }
+  bool empty() const {
+    return size() == 0;
+  }
+  Edge back() const {
+    return at(size() - 1);
+  }
+  const_iterator begin() const {
+    return const_iterator(this, 0);
+  }
+  const_iterator end() const {
+    return const_iterator(this, size());
+  }
+
+private:
+  const Edge* core; /**< The metro/core part of the route, stored in the route table of the Topology. */
+  uint coreSize; /**< The number of Edges in the metro/core part of the route. */
+  Edge first; /**< The upstream PON Edge of the source, if hasFirst is true. */
+  Edge last; /**< The downstream PON Edge of the destination, if hasLast is true. */
+  bool hasFirst; /**< True if the source of the route is a PON. */
+  bool hasLast; /**< True if the destination of the route is a PON. */
+};
 
 /**
  * A struct used to keep track of a number of statistics on traffic observed
@@ -89,6 +249,70 @@ struct NetworkStats {
   std::vector<Capacity> avgPeakMetro; /**< Average peak traffic observed on a metro edge (if present). */
 };
 
+/**
+ * The header of a routing cache file, written by Topology::saveRoutes(). It is
+ * followed by numCoreVertices^2 distances, numCoreVertices^2+1 route offsets
+ * and numRouteEdges edge ids, all stored as 32 bit unsigned integers.
+ */
+struct RouteCacheHeader {
+  char magic[8]; /**< Identifies the file as a routing cache, must be ROUTE_CACHE_MAGIC. */
+  uint32_t version; /**< The version of the layout, must be ROUTE_CACHE_VERSION. */
+  uint32_t numVertices; /**< The total number of vertices of the topology. */
+  uint64_t key; /**< The hash of the input file the topology was generated from. */
+  uint32_t numEdges; /**< The total number of edges of the topology. */
+  uint32_t numCoreVertices; /**< The number of metro/core vertices of the topology. */
+  uint32_t numRouteEdges; /**< The number of edge ids stored in the route table. */
+  uint32_t padding; /**< Unused, keeps the arrays that follow 8-byte aligned. */
+};
+const char ROUTE_CACHE_MAGIC[8] = "PLRoute";
+const uint32_t ROUTE_CACHE_VERSION = 1;
+
+/**
+ * The header of a binary topology file, written by Topology::saveBinary(). It
+ * is followed by numVertices TopologyFileVertex, numCoreVertices 
+ * TopologyFileCore and numEdges TopologyFileEdge records.
+ */
+struct TopologyFileHeader {
+  char magic[8]; /**< Identifies the file as a binary topology, must be TOPOLOGY_FILE_MAGIC. */
+  uint32_t version; /**< The version of the layout, must be TOPOLOGY_FILE_VERSION. */
+  uint32_t fixedPons; /**< If not 0, the number of customers of each PON is the stored one rather than being drawn again when the file is loaded. */
+  uint32_t numVertices; /**< The total number of vertices, metro/core ones first. */
+  uint32_t numCoreVertices; /**< The number of metro/core vertices. */
+  uint32_t numEdges; /**< The total number of edges, in the order they are added to the graph. */
+  uint32_t centralServer; /**< The vertex hosting the central server, or the maximum uint32_t value if none. */
+};
+
+/**
+ * A vertex in a binary topology file.
+ */
+struct TopologyFileVertex {
+  int32_t asid; /**< The NetworkNode::asid of the vertex. */
+  int32_t ponCustomers; /**< The NetworkNode::ponCustomers of the vertex, 0 for metro/core vertices. */
+};
+
+/**
+ * The distribution of the number of customers on the PONs attached to a 
+ * metro/core vertex, as specified by the topology file.
+ */
+struct TopologyFileCore {
+  double avgPonCustomers; /**< The mean number of customers per PON. */
+  double devPonCustomers; /**< The standard deviation of the number of customers per PON. */
+};
+
+/**
+ * An edge in a binary topology file.
+ */
+struct TopologyFileEdge {
+  uint32_t source; /**< The source vertex of the edge. */
+  uint32_t target; /**< The target vertex of the edge. */
+  double length; /**< The NetworkEdge::length of the edge. */
+  double maxCapacity; /**< The maximum capacity of the edge. */
+  uint32_t type; /**< The EdgeType of the edge. */
+  uint32_t padding; /**< Unused, keeps the records 8-byte aligned. */
+};
+const char TOPOLOGY_FILE_MAGIC[8] = "PLTopo";
+const uint32_t TOPOLOGY_FILE_VERSION = 1;
+
 /**
  * A representation of the physical topology over which the data is transmitted.
  * It is based on the Boost Graph library, specifically on the Adjacency_List.
@@ -105,29 +329,38 @@ protected:
     uint numCoreEdges; /**< The number of core edges in the topology. */
     uint numCustomers; /**< The total number of custoemrs (i.e., end-users) in the topology. */
     uint numASes;  /**< The total number of Access Sections (ASes) in the topology. Typically each core (or metro/core) node has an associated AS. */
-    DistanceMap dMap; /**< A map keeping track of the distance between vertices, used for routing purposes. */
-    PredecessorMap pMap; /**< A map of predecessors in the pre-computed shourtest path routes, used for routing purposes. */
+    uint numCoreVertices; /**< The number of metro/core vertices, i.e., those without customers. They come before all the PON vertices in the graph. */
+    std::vector<uint> distances; /**< The length of the shortest route between metro/core vertices s and d is distances[s*numCoreVertices + d]. */
+    std::vector<Edge> routeEdges; /**< The Edges of the shortest routes between every pair of metro/core vertices, stored one route after the other. */
+    std::vector<uint> routeOffsets; /**< The position in routeEdges of the route between metro/core vertices s and d is routeOffsets[s*numCoreVertices + d], and it ends where the next route begins. */
+    VertexVec accessNode; /**< For each vertex, the metro/core vertex it is attached to (for metro/core vertices, the vertex itself). */
+    std::vector<Edge> upEdges; /**< For each PON vertex, its upstream Edge towards its metro/core vertex. */
+    std::vector<Edge> downEdges; /**< For each PON vertex, its downstream Edge from its metro/core vertex. */
     Vertex centralServer; /**< The core network vertex where we are placing the central repository, i.e., the source of all ContentElement when they are first introduced in the catalog or when there is no other source available. */
     VertexMap asCacheMap; /**< A map matching each AS identifier with the vertex where the CDN server is located. */
     NetworkStats stats; /**< A collection of statistic measurements of the traffic circulating over this topology. @see NetworkStats */
     VertexVec ponNodes; /**< A vector of all the graph vertices with a non-zero number of NetworkNode::ponCustomers attached to them. These vertices will have a single link connecting them to a metro or metro/core node, representing the shared fiber tree of a PON. */
     string fileName; /**< The name of the input file used to generate the topology. */
-    LoadMap loadMap; /**< A Map associating to each edge the total traffic it has observed. Used to compute the traffic statistics at the end of each round. */
+    EdgeState edgeState; /**< The capacity, load and active Flows of each edge, indexed by NetworkEdge::id. */
     uint bitrate; /**< While not technically a topology parameter, the bitrate of the encoded content is required both in updateCapacity to estimate the time at which users will change channel (and thus to set the userViewEta) and to figure out if there's enough capacity to serve a new customer.*/
     Capacity minFlowIncrease;/**< minFlowIncrease is used in updateCapacity when adding bandwidth to a flow
      * due to the removal of some completed flow; if the increase is below this
      * threshold, no update is performed (to reduce unnecessary small changes
      * and speed up simulations). Note: this seems to hardly have any effect on
      * simulation speed, and might be removed in the future. @deprecated */
-    boost::dynamic_properties snapDp; /**< dynamic_properties are used to take snapshots of the network in
-     * Topology::printTopology(), e.g., write a graphml file with all the network metrics.
-     * Generating this object every time in that method would be needlessly
-     * expensive, so it's populated in the constructor provided that snapshots
-     * are actually going to be taken (i.e., if sanpshotFreq > 0). */
+    SnapshotWriter* snapshotWriter; /**< Writes the snapshots of the network taken by printTopology() in the background. It is only created if snapshots are actually going to be taken (i.e., if snapshotFreq > 0), and is nullptr otherwise. */
     std::map<uint, uint> ASCustomersMap; /**< A map that keeps track of how many peers are present in each AS.
      * This is needed when calculating content rates in the cache optimization
      * problem. The map is populated in the constructor, when determining the 
      * number of users per PON. */
+    bool batchMode; /**< True while the Scheduler is processing a batch of events sharing the same SimTime; in this case, bandwidth is only reallocated at the end of the batch. @see endBatch() */
+    std::set<uint> dirtyEdges; /**< The ids of the edges whose set of active Flows changed during the current batch of events. */
+    bool maxMinFair; /**< If true, bandwidth is allocated with an exact max-min fair algorithm rather than with the single bottleneck heuristic. @see reallocateMaxMinFair() */
+    FairShareState fairShare; /**< The buffers used by reallocateMaxMinFair(). */
+    std::vector<uint8_t> ponCongestion; /**< For each vertex, PON_UP_CONGESTED and/or PON_DOWN_CONGESTED if its upstream and/or downstream PON edge is congested (always 0 for metro/core vertices). */
+    std::vector<std::vector<uint> > asProximity; /**< For each AS, the other ASes reachable from it, sorted by the number of hops of the route towards it (ties broken by asid). */
+    uint numCongestedCore; /**< The number of congested metro/core edges; if 0, isCongested() only has to check the PON edges. */
+    std::vector<TopologyFileCore> ponDistribution; /**< The distribution of the number of customers per PON of each metro/core vertex, kept to export the topology with saveBinary(). */
     
     // Utility methods to streamline internal subroutines.
     /**
@@ -136,7 +369,15 @@ protected:
      * @param route The route we want to update the capacity of.
      * @param toAdd The amount of bandwidth that needs to be added (or subtracted, if negative) to each of the edges of the specified route.
      */
-    void updateRouteCapacity(std::vector<Edge> route, Capacity toAdd);
+    void updateRouteCapacity(const Route& route, Capacity toAdd);
+
+    /**
+     * Recomputes the EdgeState::congested flag of an edge after a change to its
+     * spare capacity or to its active Flows, and updates ponCongestion or
+     * numCongestedCore accordingly.
+     * @param id The NetworkEdge::id of the edge.
+     */
+    void updateCongestion(uint id);
     
     /**
      * Updates the ETA of a Flow after a bandwidth assignment change.
@@ -145,6 +386,80 @@ protected:
      */
     void updateEta(Flow* flow, Scheduler* scheduler);
     
+    /**
+     * Computes the shortest routes between all the pairs of metro/core vertices,
+     * filling the distance matrix and the route table. The shortest path tree
+     * of each metro/core vertex is computed in parallel on all the available 
+     * hardware threads.
+     */
+    void computeRoutes();
+
+    /**
+     * Loads the distance matrix and the route table from a routing cache file
+     * written by saveRoutes(). The file is memory mapped, and it is only used
+     * if it was generated from the same input file for a graph with the same
+     * number of vertices and edges.
+     * @param cacheFile The path of the routing cache file.
+     * @param key The hash of the input file this topology was generated from.
+     * @return True if the routes were loaded, False if they have to be computed.
+     */
+    bool loadRoutes(const string& cacheFile, uint64_t key);
+
+    /**
+     * Writes the distance matrix and the route table to a routing cache file,
+     * storing edges by their NetworkEdge::id. The layout is a RouteCacheHeader
+     * followed by the distances, the route offsets and the route edges as
+     * arrays of 32 bit integers, so that loadRoutes() can use them in place.
+     * @param cacheFile The path of the routing cache file.
+     * @param key The hash of the input file this topology was generated from.
+     */
+    void saveRoutes(const string& cacheFile, uint64_t key) const;
+
+    /**
+     * Builds the graph from a binary topology file written by saveBinary(). 
+     * The file is memory mapped, and vertices and edges are added in the order
+     * they are stored, which preserves the routes and the edge ids of the
+     * topology that was converted. Unless
+     * the file was written with fixed PONs, or ponCardinality is not 0, the
+     * number of customers of each PON is drawn again from the distribution of
+     * its metro/core vertex, exactly as when reading the original file.
+     * @param fileName The name of the binary topology file.
+     * @param ponCardinality If not 0, the number of customers of every PON.
+     */
+    void readBinary(const string& fileName, uint ponCardinality);
+
+    /**
+     * Assigns the next NetworkEdge::id to an edge already in the graph and 
+     * initializes its EdgeState.
+     * @param e The edge to be registered.
+     * @param cap The maximum capacity of the edge; if negative, the capacity is unlimited.
+     * @param type The EdgeType of the edge.
+     */
+    void registerEdge(Edge e, Capacity cap, EdgeType type);
+    
+    /**
+     * Adds a Flow to the list of active Flows of each edge of its route.
+     * @param flow The Flow to be added.
+     */
+    void linkFlow(Flow* flow);
+    
+    /**
+     * Removes a Flow from the list of active Flows of each edge of its route.
+     * @param flow The Flow to be removed.
+     */
+    void unlinkFlow(Flow* flow);
+    
+    /**
+     * Recomputes a max-min fair bandwidth allocation, by progressive filling,
+     * for all the Flows in the connected component of capacity-limited Edges 
+     * and Flows that includes the specified Edges. Each Flow can get at most 
+     * MAX_FLOW_SPEED or its chunk size, whichever is lower. The allocation of
+     * the Flows outside of the component is left untouched.
+     * @param seeds The ids of the Edges whose set of active Flows has just changed.
+     * @param scheduler A pointer to the Scheduler, which will ensure that any change to the ETA of some Flow will be reflected in the ordering of the queued events.
+     */
+    void reallocateMaxMinFair(const std::vector<uint>& seeds, Scheduler* scheduler);
+    
 public:
     /**
      * Builds the topology from a topology file. The recommended option is to
@@ -179,10 +494,28 @@ public:
      * The graph is directed but for each pair of vertices, sourceId and destId, two 
      * links (one per direction) are created.
      * 
+     * Finally, a topology converted with saveBinary() can be loaded much faster
+     * from its binary file, which MUST have a .ptopo extension.
+     *
      * @param fileName the name of the file from which the topology should be generated.
      * @param vm the set of simulation parameters specified at command line by the user.
      */
     Topology(string fileName, po::variables_map vm);
+    /**
+     * Waits for the pending snapshots of the network to be written.
+     */
+    ~Topology();
+
+    /**
+     * Writes the topology to a binary file that can be loaded by the constructor
+     * (through readBinary()) without parsing. All the vertices and edges are
+     * stored, including the PON ones, together with the distribution of the
+     * number of customers per PON of each metro/core vertex.
+     * @param binFileName The name of the binary file, which should have a .ptopo extension.
+     * @param fixedPons If true, loading the file will use the current number of customers of each PON instead of drawing it again.
+     * @return True if the file was written successfully, False otherwise.
+     */
+    bool saveBinary(const string& binFileName, bool fixedPons) const;
     /**
      * Retrieves all the vertices with customers attached to them.
      * In other words, all the vertices with a non-zero value of
@@ -194,23 +527,24 @@ public:
      * Computes the hop-distance between two vertices.
      * @param source The source vertex of the route.
      * @param dest The destination vertex of the route.
-     * @return The number of hops required to go from source to dest over the shortest route.
+     * @return The number of hops required to go from source to dest over the shortest route, or std::numeric_limits<uint>::max() if dest cannot be reached from source.
      */
     uint getDistance(uint source, uint dest) const;
     /**
      * Retrieves the shortest path between a source and a destination Vertex.
+     * Routes are pre-computed in the constructor, so this does not allocate.
      * @param source The source vertex of the route.
      * @param dest The destination vertex of the route.
-     * @return A vector of Edges that constitute the shortest route between source and dest.
+     * @return A view of the Edges that constitute the shortest route between source and dest.
      */
-    std::vector<Edge> getRoute(uint source, uint dest) const;
+    Route getRoute(uint source, uint dest) const;
     /**
      * Retrieves the shortest path between a source and a destination user.
      * @param source The source user of the route.
      * @param destination The destination user of the route.
-     * @return A vector of Edges that constitute the shortest route between source and destination.
+     * @return A view of the Edges that constitute the shortest route between source and destination.
      */
-    std::vector<Edge> getRoute(PonUser source, PonUser destination) const {
+    Route getRoute(PonUser source, PonUser destination) const {
       return this->getRoute(source.first, destination.first);
     }
     /**
@@ -231,12 +565,33 @@ public:
      * maximum available capacity per user and the limits imposed by TCP 
      * mechanisms (e.g., due to the congestion control mechanisms, as we do not 
      * simulate packet loss). 
+     * If the max-min-fair option is set, the heuristic above is replaced by an
+     * exact max-min fair allocation over the Flows affected by the change.
+     * @see reallocateMaxMinFair()
      * @param flow The data flow that has been just added or removed.
      * @param scheduler A pointer to the Scheduler, which will ensure that any change to the ETA of some Flow will be reflected in the ordering of the queued events.
      * @param addNotRemove True if the flow is a new transfer being added, false if it is a completed flow that needs to be removed.
      */
     void updateCapacity(Flow* flow, Scheduler* scheduler, 
           bool addNotRemove);
+    /**
+     * Starts a batch of Flow additions and removals. Until endBatch() is invoked,
+     * updateCapacity() only updates the set of Flows active on each edge (and 
+     * frees the bandwidth of the removed ones), without reallocating bandwidth.
+     */
+    void beginBatch();
+    /**
+     * Closes a batch of Flow additions and removals, reallocating the bandwidth
+     * of every Flow which shares an edge with the Flows added or removed in the
+     * batch. Each Flow is first reduced to its fair share, i.e., the minimum 
+     * across its route of the capacity of each edge divided by the number of 
+     * Flows on it, and then increased towards that share as far as the spare 
+     * capacity on its route allows, starting from the newly added Flows. If the
+     * max-min-fair option is set, the exact max-min fair allocation is 
+     * recomputed instead, once for all the Flows affected by the batch.
+     * @param scheduler A pointer to the Scheduler, which will ensure that any change to the ETA of some Flow will be reflected in the ordering of the queued events.
+     */
+    void endBatch(Scheduler* scheduler);
     /**
      * Computes the traffic statistics for the round that just ended, stores them 
      * in the NetworkStats structures, and prints them to screen.
@@ -250,14 +605,14 @@ public:
      */
     void resetFlows();
     /**
-     * Updates the LoadMap by adding the data transmitted through the specified 
-     * Flow to each of the Edges composing its route. Invoked by the TopologyOracle
+     * Updates the load of the edges by adding the data transmitted through the
+     * specified Flow to each of the Edges composing its route. Invoked by the TopologyOracle
      * once the Flow has completed its transfer.
      * @param flow The Flow that has just completed its data transfer.
      */
     void updateLoadMap(Flow* flow);
     /**
-     * Resets the content of LoadMap, setting the total transferred Mb for each
+     * Resets the load of the edges, setting the total transferred Mb for each
      * Edge in the topology to 0.
      */
     void resetLoadMap();
@@ -285,11 +640,24 @@ public:
      * @return A vector with all the Vertices hosting local CDN caches for some AS.
      */
     VertexVec getLocalCacheNodes() const;
+    /**
+     * Retrieves the other Access Sections (ASes), from the closest to the
+     * farthest one from the specified AS, by number of hops between their 
+     * metro/core vertices. ASes which cannot reach it are left out. 
+     * @param asid The id of the AS the other ASes are sorted by proximity to.
+     * @return The ids of the other ASes, sorted by increasing hop count towards asid.
+     */
+    const std::vector<uint>& getASesByProximity(uint asid) const {
+      return asProximity.at(asid);
+    }
     /**
      * Checks whether there is enough spare capacity in the network to serve a request
      * from source to destination.
      * @param source The proposed source for the item requested.
      * @param destination The destination of the request.
+     * This only tests the congestion bits of the PONs at either end, plus the
+     * congestion flags of the metro/core edges of the route if any of them is
+     * congested.
      * @return True if there is enough bandwidth to at least transfer the item at its encoding bitrate, false otherwise.
      */
     bool isCongested(PonUser source, PonUser destination) const;
@@ -305,9 +673,10 @@ public:
      */
     bool addEdge(Vertex src, Vertex dest, Capacity cap, EdgeType type);
     /**
-     * Prints a graphml snapshot of the current topology, including the available
+     * Takes a snapshot of the current topology, including the available
      * capacity on metro/core edges. Useful to visualize the traffic generated
-     * by the model being used.
+     * by the model being used. Only the per-edge counters are copied here; the
+     * snapshot is written to file in the background by the SnapshotWriter.
      * @param time The SimTime at which the snapshot is being taken.
      * @param round The current round of simulation.
      */
@@ -6,16 +6,87 @@
 #include <initializer_list>
 #include <boost/random/mersenne_twister.hpp>
 #include <cmath>
+#ifdef USE_CPLEX
 #define ILOUSESTL
 #define IL_STD
 #include "ilcplex/ilocplex.h"
+#endif
 
 // random generator
 extern boost::mt19937 gen;
 
+#ifdef USE_CPLEX
+/**
+ * The variable and the upload rate constraint of a chunk in the model of a 
+ * user, with the generation of the last call in which the chunk was cached.
+ */
+struct CplexChunkVar {
+  IloNumVar c;
+  IloRange rate;
+  uint generation;
+};
+
+/**
+ * The objective, size constraint and chunk variables of the cache optimization
+ * problem of a user. Variables are only added and removed as chunks enter and
+ * leave the cache of the user; they are only part of a model (and extracted by
+ * CPLEX) while the user is the active one of its AS.
+ */
+struct CplexUserModel {
+  IloObjective obj;
+  IloRange size;
+  uint generation;
+  std::unordered_map<const ContentChunk*, CplexChunkVar> vars;
+  
+  CplexUserModel(IloEnv env, Capacity maxSize) : obj(IloMinimize(env)), 
+          size(env, -IloInfinity, maxSize) {
+    generation = 0;
+  }
+};
+
+/**
+ * The model and the CPLEX instance shared by all the users of an AS, holding 
+ * the problem of the user whose cache was optimized last. Switching to another
+ * user only swaps the extractables of the two users, so the memory taken by 
+ * CPLEX grows with the number of ASes rather than with the number of users.
+ */
+struct CplexASModel {
+  IloModel model;
+  IloCplex cplex;
+  CplexUserModel* active;
+  
+  CplexASModel(IloEnv env) : model(env) {
+    cplex = IloCplex(model);
+    cplex.setOut(env.getNullStream());
+    active = nullptr;
+  }
+};
+
+struct CplexCachingModels {
+  IloEnv env;
+  std::map<uint, CplexASModel*> ases;
+  std::map<PonUser, CplexUserModel*> users;
+  
+  ~CplexCachingModels() {
+    for (auto it = ases.begin(); it != ases.end(); it++)
+      delete it->second;
+    ases.clear();
+    for (auto it = users.begin(); it != users.end(); it++)
+      delete it->second;
+    users.clear();
+    // frees all the models at once
+    env.end();
+  }
+};
+#endif
+
 TopologyOracle::TopologyOracle(Topology* topo, po::variables_map vm, uint roundDuration) {
   this->roundDuration = roundDuration;
-  this->cachingOpt = vm["optimize-caching"].as<bool>();
+  this->cachingOpt = (CachingSolver) vm["optimize-caching"].as<uint>();
+  this->periodicCachingOpt = vm["optimize-freq"].as<uint>() > 0;
+#ifdef USE_CPLEX
+  this->cplexModels = (cachingOpt == CPLEX_SOLVER) ? new CplexCachingModels() : nullptr;
+#endif
   this->ponCardinality = vm["pon-cardinality"].as<uint>();
   this->policy = (CachePolicy) vm["cache-policy"].as<uint>();
   this->maxCacheSize = vm["ucache-size"].as<uint>() * 8000; // input is in GB, variable in Mb
@@ -51,11 +122,11 @@ TopologyOracle::TopologyOracle(Topology* topo, po::variables_map vm, uint roundD
   flowStats.congestionBlocked.assign(rounds, 0);
   flowStats.cacheOptimized.assign(rounds, 0);
   this->userCacheMap = new UserCacheMap;
-  this->asidContentMap = new AsidContentMap;
-  for (uint i = 0; i < topo->getNumASes(); i++) {
-    ChunkMap map;
-    asidContentMap->insert(std::make_pair(i,map));
-  }
+  this->asidContentMap = new AsidContentMap(topo->getNumASes());
+  this->chunkVersion.resize(topo->getNumASes());
+  this->lastChunkVersion = 0;
+  this->chunkRateTable.resize(7 * topo->getNumASes());
+  this->chunkRateHour = -1;
   
   // Initialize user cache map
     VertexVec ponNodes = topo->getPonNodes();
@@ -98,6 +169,9 @@ TopologyOracle::~TopologyOracle() {
   localCacheMap->clear();
   delete this->localCacheMap;
   dailyRanking.clear();
+#ifdef USE_CPLEX
+  delete this->cplexModels;
+#endif
 }
 
 void TopologyOracle::addToCache(PonUser user, ChunkPtr chunk, SimTime time) {
@@ -106,21 +180,7 @@ void TopologyOracle::addToCache(PonUser user, ChunkPtr chunk, SimTime time) {
     abort();
   }
   ContentElement* content = chunk->getContent();
-  uint chunkIndex = chunk->getIndex();
-  // update the chunkMap for content retrieval
-  uint asid = topo->getAsid(user);
-  ChunkMap::iterator cIt = asidContentMap->at(asid).find(chunk);
   std::pair<bool, std::set<ChunkPtr> > addResult;
-  if (cIt == asidContentMap->at(asid).end()) {
-    // This is the first time the oracle sees this chunk, add it to the map
-    // Note: this should not happen now, throw an error
-    BOOST_LOG_TRIVIAL(error) << time << ":ERROR: TopologyOracle::addToCache() - "
-            "unknown chunk for content " << content->getName() << 
-            ", chunkId " << chunkIndex;
-    abort();
-    // std::set<PonUser> sourceNodes;
-    // cIt = asidContentMap->at(asid).insert(std::make_pair(content, sourceNodes)).first;
-  }
   // update userCacheMap according to the specified cache policy
   BOOST_LOG_TRIVIAL(trace) << time << ": caching chunk " << 
           chunk->getIndex() << " of content " << content->getName() << 
@@ -134,28 +194,15 @@ void TopologyOracle::addToCache(PonUser user, ChunkPtr chunk, SimTime time) {
             << " at User "  << user.first << "," << user.second;
     }
   } else {
-   /* if caching at the user was successful, add the user to the asidCacheMap
-    * for its AS (cIt is the iterator to the right position in the map, see above)
-    * note that the user might be already there if he had a copy of the content
-    * with a different size
+   /* if caching at the user was successful, add the user to the asidContentMap
+    * for its AS; note that the user might be already there if he had a copy of
+    * the content with a different size
     */
-    if (cIt->second.find(user) == cIt->second.end()) {
-      bool insert = cIt->second.insert(user).second;
-      if (!insert) {
-        BOOST_LOG_TRIVIAL(warning) << time << ": WARNING: failed to insert User " 
-                << user.first << "," << user.second << " as a source for chunk "
-                << chunk->getIndex() << " of content "
-                << content->getName() << " in AS " << asid;
-      }
-    }
+    this->addToCMap(chunk, user);
   }
   BOOST_FOREACH (ChunkPtr e, addResult.second) {
     // erase the content from the ContentMap entry of the user
     this->removeFromCMap(e, user);
-    // update the asidContentMap too
-    cIt = asidContentMap->at(asid).find(e);
-    if (cIt != asidContentMap->at(asid).end())
-      cIt->second.erase(user);
   }
  
   if (!reducedCaching && !preCaching) {
@@ -185,12 +232,12 @@ void TopologyOracle::clearUserCache() {
     uIt->second.clearCache();
   }
   // clear the chunkMap to be consistent with the user caches
-  AsidContentMap::iterator aIt;
-  for (aIt = asidContentMap->begin(); aIt != asidContentMap->end(); aIt++) {
-    ChunkMap::iterator cIt;
-    for (cIt = aIt->second.begin(); cIt != aIt->second.end(); cIt++) {
-      cIt->second.clear();
-    }
+  BOOST_FOREACH (ChunkMap& chunkMap, *asidContentMap) {
+    chunkMap.clear();
+  }
+  chunkPresence.clear();
+  BOOST_FOREACH (ChunkVersionMap& versions, chunkVersion) {
+    versions.clear();
   }
 }
 
@@ -231,8 +278,7 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
     flow->setSource(destination);
     flow->setEta(time);
     // update this user's cacheMap entry (for LRU/LFU)
-    bool result = userCacheMap->at(destination).getFromCache(chunk,
-            (scheduler->getCurrentRound()+1)*time, true);
+    bool result = userCacheMap->at(destination).getFromCache(chunk, time, true);
     assert(result);
     flowStats.servedRequests.at(scheduler->getCurrentRound())++;
     flowStats.completedRequests.at(scheduler->getCurrentRound())++;
@@ -247,27 +293,8 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
   }
   // try to find a local peer first
   uint asid = topo->getAsid(destination);
-  std::set<PonUser> localSources = asidContentMap->at(asid).at(chunk);
-  // copy the set to a vector which can then be randomized to reduce the chance
-  // the same peer will be selected over and over until congestion is reached
-  std::vector<PonUser> randSources(localSources.begin(), localSources.end());
-  std::random_shuffle(randSources.begin(), randSources.end());
-  localSources.clear();  
-  bool foundSource = false;
-  // Attempts to find the closest source whose route to the destination is not congested
-  while (!randSources.empty() && !foundSource) {
-    closestSource = randSources.back();
-    // check if the identified source has enough content to serve this request
-    if (this->checkIfCached(closestSource, chunk) 
-            && !topo->isCongested(closestSource, destination))
-      foundSource = true;
-    else {
-      // erase closestSource from randSources
-      randSources.pop_back();
-      closestSource = UNKNOWN;
-    }
-  }
-  if (!foundSource)  
+  closestSource = this->findRandomSource(chunk, asid, destination);
+  if (closestSource == UNKNOWN)  
   {
     // Couldn't find a local source for the required content, check for the 
     // local AS cache (unless we're in reducedCaching mode)
@@ -287,9 +314,9 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
                 << " from AS cache node " << lCache
                 << " (closestSource=" << closestSource.first
                 << "," << closestSource.second << ")";
-        this->getFromLocalCache(lCache, chunk, 
-                (scheduler->getCurrentRound()+1)*time);
+        this->getFromLocalCache(lCache, chunk, time);
         flow->setSource(std::make_pair(lCache, 0));
+        scheduler->setRoute(flow, topo->getRoute(flow->getSource(), destination));
         flowStats.servedRequests.at(scheduler->getCurrentRound())++;
         flowStats.localRequests.at(scheduler->getCurrentRound())++;
         flow->setP2PFlow(false);
@@ -302,58 +329,17 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
     BOOST_LOG_TRIVIAL(trace) << "No local source found for chunk " << chunkId
             << " of content "+
             contentName+" , searching for non-local P2P sources";
-    uint minDistance, distance, asIndex;
-    ChunkMap::iterator cIt;
-    // vector of ASes which have already explored for viable sources
-    std::vector<bool> exploredASes(topo->getNumASes(), false);
-    exploredASes[asid] = true;
-    foundSource = false;
-    while (std::find(exploredASes.begin(), exploredASes.end(), false) != exploredASes.end()
-            && !foundSource) {
-      // identify an AS with minimum distance from destination
-      minDistance = INF_TIME;
-      for (uint i = 0; i < topo->getNumASes(); i++) {
-        if (exploredASes[i])
+    ChunkPresenceMap::const_iterator pIt = chunkPresence.find(chunk.get());
+    if (pIt != chunkPresence.end()) {
+      // scan the ASes with some source, starting from the closest to the destination
+      BOOST_FOREACH (uint asIndex, topo->getASesByProximity(asid)) {
+        if (!pIt->second[asIndex])
           continue;
-        cIt = asidContentMap->at(i).find(chunk);
-        if (cIt == asidContentMap->at(i).end() || cIt->second.empty()) {
-          // this AS has no source with the required chunk, mark it as explored
-          // to save time at a future iteration
-          BOOST_LOG_TRIVIAL(trace) << "No viable source for chunk " << chunkId
-            << " of content " + contentName + " in asid " << i;
-          exploredASes[i] = true;
-        } else {
-          distance = topo->getRoute(*(cIt->second.begin()), destination).size();
-          if (distance < minDistance) {
-            minDistance = distance;
-            asIndex = i;
-          }
-        }
+        closestSource = this->findRandomSource(chunk, asIndex, destination);
+        if (closestSource != UNKNOWN)
+          break;
       }
-      // scan available sources in the identified closer AS
-      if (minDistance != INF_TIME) {
-        // Attempts to find the closest source whose route to the destination is not congested
-        localSources.clear();
-        localSources = asidContentMap->at(asIndex).at(chunk);
-        randSources.clear();
-        randSources.assign(localSources.begin(), localSources.end());
-        std::random_shuffle(randSources.begin(), randSources.end());
-        localSources.clear();  
-        while (!randSources.empty() && !foundSource) {
-          closestSource = randSources.back();
-          // check if the identified source has enough content to serve this request
-          if (this->checkIfCached(closestSource, chunk) 
-                  && !topo->isCongested(closestSource, destination))
-              foundSource = true;
-          else {
-            // erase closestSource from randSources
-            randSources.pop_back();
-            closestSource = UNKNOWN;
-          }
-        }
-        exploredASes[asIndex] = true;
-      }
-    }    
+    }
   }
   // if the closestSource is still unknown, we have to go to the central server
   if (closestSource == UNKNOWN) {
@@ -376,12 +362,10 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
     if (reducedCaching) {
       if (!checkIfCached(centralServer, chunk)) {
         localCacheMap->at(centralServer).addToCache(chunk, 
-                chunk->getSize(), 
-                (scheduler->getCurrentRound()*roundDuration)+time);
+                chunk->getSize(), time);
       }
       // update LFU/LRU stats
-      this->getFromLocalCache(centralServer, chunk, 
-              (scheduler->getCurrentRound()+1)*time);
+      this->getFromLocalCache(centralServer, chunk, time);
     }
     flow->setP2PFlow(false);
     // debug info
@@ -393,9 +377,9 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
   } else {
     // p2p flow, update user cache statistics (for LFU/LRU purposes)
     flow->setP2PFlow(true);
-    bool result = userCacheMap->at(closestSource).getFromCache(chunk,
-            (scheduler->getCurrentRound()+1)*time, false);
+    bool result = userCacheMap->at(closestSource).getFromCache(chunk, time, false);
     assert(result);
+    this->touchHolder(closestSource);
     // check for locality is done here to avoid central server to be mistakenly
     // identified as local
     if (topo->isLocal(destination.first, closestSource.first))
@@ -411,6 +395,7 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
   }
   // Assign the closest source to the flow
   flow->setSource(closestSource);
+  scheduler->setRoute(flow, topo->getRoute(closestSource, destination));
   // Update flow statistics
   flowStats.servedRequests.at(scheduler->getCurrentRound())++;
   // schedule flow with INF_TIME ETA so that it's in the queue for future updating
@@ -420,6 +405,30 @@ bool TopologyOracle::serveRequest(Flow* flow, Scheduler* scheduler) {
   return true;
 }
 
+/* Probes the holders in random order, to reduce the chance that the same peer 
+ * will be selected over and over until congestion is reached. This is a partial
+ * Fisher-Yates shuffle done in place on the holders of the chunk, whose order 
+ * does not matter, so that no copy is needed and only the probed peers are 
+ * actually drawn.
+ */
+PonUser TopologyOracle::findRandomSource(const ChunkPtr& chunk, uint asid,
+        PonUser destination) {
+  ChunkMap::iterator cIt = asidContentMap->at(asid).find(chunk.get());
+  if (cIt == asidContentMap->at(asid).end())
+    return UNKNOWN;
+  HolderVec& holders = cIt->second;
+  for (uint left = holders.size(); left > 0; left--) {
+    boost::random::uniform_int_distribution<uint> pick(0, left - 1);
+    std::swap(holders[pick(gen)], holders[left - 1]);
+    PonUser candidate = holders[left - 1];
+    // check if the candidate has enough content to serve this request
+    if (this->checkIfCached(candidate, chunk) 
+            && !topo->isCongested(candidate, destination))
+      return candidate;
+  }
+  return UNKNOWN;
+}
+
 void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
   PonUser dest = flow->getDestination();
   SimTime time = scheduler->getSimTime();
@@ -470,9 +479,10 @@ void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
       // notify the source cache that it has completed this upload
       PonUser source = flow->getSource();
       bool retValue(false);
-      if (flow->isP2PFlow())
+      if (flow->isP2PFlow()) {
         retValue = userCacheMap->at(source).uploadCompleted(chunk);
-      else
+        this->touchHolder(source);
+      } else
         retValue = localCacheMap->at(source.first).uploadCompleted(chunk);
       assert(retValue);
       // update cache info (unless the content has expired, e.g. a flow carried over
@@ -487,8 +497,8 @@ void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
          * Note that in the popularity estimation branch, we should try to optimize
          * only when we know enough about the content - e.g. a round.
          */
-        if (round == 0 || !cachingOpt) {
-          this->addToCache(dest, chunk, round * roundDuration + time);
+        if (round == 0 || cachingOpt == NO_CACHING_OPT || periodicCachingOpt) {
+          this->addToCache(dest, chunk, time);
         } else {
           std::pair<bool, bool> optResult = this->optimizeCaching(dest, chunk,
                   time, round);
@@ -497,11 +507,17 @@ void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
            * in the second case elements that need to be removed have already been erased
            */
           if (!optResult.first || (optResult.first && optResult.second)) {
-            this->addToCache(dest, chunk, round * roundDuration + time);
+            this->addToCache(dest, chunk, time);
           }
           // also record if the cache optimization was successful 
-          if (optResult.first == true)
+          if (optResult.first == true) {
             flowStats.cacheOptimized.at(round)++;
+            /* the stamp is taken once the new chunk has been cached, since its
+             * admission changes the versions of the cache and of the chunk
+             */
+            cachingStamps[dest] = this->getCachingStamp(dest, 
+                    this->getHourOfDay(time, round), round);
+          }
         }
       }
       // free resources in the topology
@@ -532,7 +548,7 @@ void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
           }
           SimTime eta = scheduler->getSimTime() +
                   std::ceil(chunk->getSize() / this->bitrate);
-          Flow* watchEvent = new Flow(flow->getContent(), dest, eta, chunk->getIndex(),
+          Flow* watchEvent = scheduler->createFlow(flow->getContent(), dest, eta, chunk->getIndex(),
                   FlowType::WATCH);
           scheduler->schedule(watchEvent);
           userWatchMap.at(dest).waiting = false;          
@@ -588,7 +604,7 @@ void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
               userWatchMap.at(dest).highestChunkFetched < flow->getContent()->getTotalChunks()-1) {    
         BOOST_LOG_TRIVIAL(debug) << "There's " << bufferSlots << " slots in the buffer, "
                 "pre-fetching chunk " << userWatchMap.at(dest).highestChunkFetched+1;                
-        Flow* requestChunk = new Flow(flow->getContent(), dest, time, 
+        Flow* requestChunk = scheduler->createFlow(flow->getContent(), dest, time, 
                 userWatchMap.at(dest).highestChunkFetched+1);
         scheduler->schedule(requestChunk);
         userWatchMap.at(dest).highestChunkFetched++;
@@ -607,7 +623,7 @@ void TopologyOracle::notifyCompletedFlow(Flow* flow, Scheduler* scheduler) {
                 << ") in the buffer, starting a new WATCH flow";
         SimTime eta = scheduler->getSimTime() + 
                 std::ceil(flow->getContent()->getChunkById(completedChunk+1)->getSize() / this->bitrate);
-        Flow* watchEvent = new Flow(flow->getContent(), dest, eta, completedChunk+1, 
+        Flow* watchEvent = scheduler->createFlow(flow->getContent(), dest, eta, completedChunk+1, 
                 FlowType::WATCH);
         scheduler->schedule(watchEvent);
         // and remove the waiting status in case it was set
@@ -645,12 +661,17 @@ void TopologyOracle::notifyEndRound(uint endingRound) {
   }
   BOOST_LOG_TRIVIAL(trace) << "old rate for day 0 rank 0: " << old << ", new: "
           << contentRateVec.at(0).at(0) << ", daily hits: " << dailyRanking.at(0).getHitsByRank(0);
+  // the memoized chunk rates are based on the old contentRateVec
+  chunkRateHour = -1;
   return;
 }
 
-std::set<PonUser> TopologyOracle::getSources(const ChunkPtr& chunk,
-        uint asid) {
-  return asidContentMap->at(asid).at(chunk);
+HolderVec TopologyOracle::getSources(const ChunkPtr& chunk,
+        uint asid) const {
+  ChunkMap::const_iterator cIt = asidContentMap->at(asid).find(chunk.get());
+  if (cIt == asidContentMap->at(asid).end())
+    return HolderVec();
+  return cIt->second;
 }
 
 void TopologyOracle::printStats(uint currentRound) {
@@ -740,20 +761,14 @@ void TopologyOracle::printStats(uint currentRound) {
 }
 
 /* addContent performs the maintenance steps required when adding a new element
- * to the catalog, i.e., creating entries in the AsidContentMap for each chunk
- * and adding it to the central repository if we are in reducedCaching mode.
+ * to the catalog, i.e., adding it to the central repository if we are in 
+ * reducedCaching mode. The AsidContentMap entries of its chunks are only 
+ * created when they are first cached by some user.
  */
 void TopologyOracle::addContent(ContentElement* content, uint elapsedRounds) {
   SimTime time = elapsedRounds * roundDuration;
-  AsidContentMap::iterator aIt;
   std::vector<ChunkPtr>::iterator cIt;
   std::vector<ChunkPtr> chunks = content->getChunks();
-  for (aIt = asidContentMap->begin(); aIt != asidContentMap->end(); aIt++) {
-    std::set<PonUser> users;
-    for (cIt = chunks.begin(); cIt != chunks.end(); cIt++) {
-      aIt->second.insert(std::make_pair(*cIt, users));
-    }
-  }
   if (this->reducedCaching) {
     for (LocalCacheMap::iterator lit = localCacheMap->begin();
             lit != localCacheMap->end(); lit++) {
@@ -772,15 +787,26 @@ void TopologyOracle::addContent(ContentElement* content, uint elapsedRounds) {
 void TopologyOracle::removeContent(ContentElement* content, uint roundsElapsed) {
   // erase the expiring content from all user and local caches
   SimTime time = roundsElapsed * roundDuration;
-  AsidContentMap::iterator aIt;
   std::vector<ChunkPtr>::iterator cIt;
   std::vector<ChunkPtr> chunks = content->getChunks();
-  for (aIt = asidContentMap->begin(); aIt != asidContentMap->end(); aIt++) {
+  BOOST_FOREACH (ChunkMap& chunkMap, *asidContentMap) {
     for (cIt = chunks.begin(); cIt != chunks.end(); cIt++) {
-      BOOST_FOREACH(PonUser user, aIt->second.at(*cIt)) {
+      ChunkMap::iterator hIt = chunkMap.find(cIt->get());
+      if (hIt == chunkMap.end())
+        continue;
+      BOOST_FOREACH(PonUser user, hIt->second) {
+        // the uploads of the chunk, if any, no longer take up slots of the user
+        if (userCacheMap->at(user).getCurrentUploads(*cIt) > 0)
+          this->touchHolder(user);
         userCacheMap->at(user).removeFromCache(*cIt, time);
       }
-    aIt->second.erase(*cIt);
+      chunkMap.erase(hIt);
+    }
+  }
+  for (cIt = chunks.begin(); cIt != chunks.end(); cIt++) {
+    chunkPresence.erase(cIt->get());
+    BOOST_FOREACH (ChunkVersionMap& versions, chunkVersion) {
+      versions.erase(cIt->get());
     }
   }
   for (LocalCacheMap::iterator lit = localCacheMap->begin(); 
@@ -810,234 +836,412 @@ void TopologyOracle::getFromLocalCache(Vertex lCache, const ChunkPtr& chunk,
   }
 }
 
+void TopologyOracle::addToCMap(const ChunkPtr& chunk, PonUser user) {
+  uint asid = topo->getAsid(user);
+  HolderVec& holders = (*asidContentMap)[asid][chunk.get()];
+  if (holders.empty()) {
+    // first holder of this chunk in the AS
+    std::vector<bool>& presence = chunkPresence[chunk.get()];
+    presence.resize(topo->getNumASes(), false);
+    presence[asid] = true;
+  }
+  if (std::find(holders.begin(), holders.end(), user) == holders.end()) {
+    holders.push_back(user);
+    chunkVersion[asid][chunk.get()] = ++lastChunkVersion;
+  }
+}
+
 void TopologyOracle::removeFromCMap(const ChunkPtr& chunk, PonUser user) {
-  uint asid = topo->getAsid(user);  
-  std::set<PonUser>::iterator uIt = asidContentMap->at(asid).at(chunk).find(user);
-  if (uIt == asidContentMap->at(asid).at(chunk).end()) {
+  uint asid = topo->getAsid(user);
+  ChunkMap& chunkMap = asidContentMap->at(asid);
+  ChunkMap::iterator cIt = chunkMap.find(chunk.get());
+  HolderVec::iterator uIt;
+  if (cIt == chunkMap.end() || 
+          (uIt = std::find(cIt->second.begin(), cIt->second.end(), user)) == cIt->second.end()) {
     BOOST_LOG_TRIVIAL(trace) << "Attempted to remove missing chunk " << chunk->getIndex()
               << " from the cache of user " << user.first << ","
               << user.second;
     return;
-  } else
-    asidContentMap->at(asid).at(chunk).erase(uIt);
+  }
+  // the order of the holders does not matter, swap with the last one
+  *uIt = cIt->second.back();
+  cIt->second.pop_back();
+  if (!cIt->second.empty())
+    chunkVersion[asid][chunk.get()] = ++lastChunkVersion;
+  else {
+    chunkMap.erase(cIt);
+    chunkVersion[asid].erase(chunk.get());
+    std::vector<bool>& presence = chunkPresence.at(chunk.get());
+    presence[asid] = false;
+    if (std::find(presence.begin(), presence.end(), true) == presence.end())
+      chunkPresence.erase(chunk.get());
+  }
 }
 
-std::pair<bool, bool> TopologyOracle::optimizeCaching(PonUser reqUser, 
-        const ChunkPtr& chunk, SimTime time, uint currentRound) {
-  SimTime absTime = time + (currentRound*roundDuration);
-  /* This should no longer apply as chunks are either cached entirely or not cached
-   * 
-   * there is an inconsistence in our assumptions here, in that we add 
-   * an optimization variable for the requested content in addition to the 
-   * variables we have for the elements cached, but there is a chance that the 
-   * requested content was already cached (albeit with a different size). I need
-   * to either make sure that this case is covered or that it never happens (e.g.,
-   * by deleting it). In the next few lines I attempt to do so.
-    
-  if (checkIfCached(reqUser, content) == true) {
-    userCacheMap->at(reqUser).removeFromCache(content, absTime);
-    removeFromCMap(content, reqUser);
+/* The upload slots a holder offers for each of its chunks depend on its total
+ * uploads, so any upload affects the problems involving all its chunks.
+ */
+void TopologyOracle::touchHolder(PonUser user) {
+  ChunkVersionMap& versions = chunkVersion.at(topo->getAsid(user));
+  const auto& cached = userCacheMap->at(user).getCacheMap();
+  for (auto it = cached.begin(); it != cached.end(); it++) {
+    ChunkVersionMap::iterator vIt = versions.find(it->first.get());
+    if (vIt != versions.end())
+      vIt->second = ++lastChunkVersion;
+  }
+}
+
+/* The upload rate constraint of a chunk only involves the holders of that 
+ * chunk in the AS, and dropping a chunk that is not being uploaded does not 
+ * change the upload slots available at its holder. Hence each chunk can be 
+ * handled on its own: keeping the holders with the most upload slots first
+ * minimizes the number of copies needed to cover its peak request rate.
+ */
+void TopologyOracle::optimizeCaches(SimTime time, uint currentRound) {
+  // as for optimizeCaching(), we need a round of popularity estimations first
+  if (currentRound == 0 || cachingOpt == NO_CACHING_OPT)
+    return;
+  int hour = this->getHourOfDay(time, currentRound);
+  std::vector<std::pair<ChunkPtr, PonUser> > toDrop;
+  std::vector<std::pair<int, PonUser> > slots;
+  for (uint asid = 0; asid < asidContentMap->size(); asid++) {
+    for (ChunkMap::iterator cIt = asidContentMap->at(asid).begin(); 
+            cIt != asidContentMap->at(asid).end(); cIt++) {
+      const ChunkPtr chunk = cIt->first->getContent()->getChunkById(cIt->first->getIndex());
+      // signed, so that a content released in the future trips the assertion
+      int dayIndex = (int) currentRound - chunk->getContent()->getReleaseDay();
+      assert(dayIndex >= 0 && dayIndex < 7);
+      // young contents are kept, as their ranking is still too volatile
+      if (dayIndex == 0 && hour < 6)
+        continue;
+      int chunkRate = this->computeChunkRate(chunk, hour, asid, dayIndex);
+      // the holders that are uploading the chunk have to keep it
+      int covered = 0;
+      slots.clear();
+      BOOST_FOREACH (PonUser user, cIt->second) {
+        const ChunkCache& cache = userCacheMap->at(user);
+        int userSlots = (int) maxUploads - cache.getTotalUploads() 
+                + cache.getCurrentUploads(chunk);
+        if (cache.getCurrentUploads(chunk) > 0)
+          covered += userSlots;
+        else
+          slots.push_back(std::make_pair(userSlots, user));
+      }
+      std::sort(slots.begin(), slots.end(), 
+              [](const std::pair<int, PonUser>& a, const std::pair<int, PonUser>& b) {
+                return a.first > b.first;
+              });
+      uint kept = 0;
+      while (kept < slots.size() && covered < chunkRate)
+        covered += slots[kept++].first;
+      for (uint i = kept; i < slots.size(); i++)
+        toDrop.push_back(std::make_pair(chunk, slots[i].second));
+    }
   }
-  */
-  int hour = std::floor(time / 3600);
+  // removeFromCMap() changes the content maps, hence the removals are deferred
+  for (uint i = 0; i < toDrop.size(); i++) {
+    userCacheMap->at(toDrop[i].second).removeFromCache(toDrop[i].first, time);
+    removeFromCMap(toDrop[i].first, toDrop[i].second);
+  }
+  BOOST_LOG_TRIVIAL(debug) << time << ": cache optimization dropped " 
+          << toDrop.size() << " redundant chunk copies";
+}
+
+int TopologyOracle::computeChunkRate(const ChunkPtr& chunk, int hour, uint asid,
+        uint dayIndex) {
+  /* the contentRateVec holds the number of requests expected for each content
+   * per day. To get the number of requests per hour per AS we need
+   * to get the % of requests in this particular hour via usrPctgByHour and
+   * multiply it by the fraction of users in the AS of the requester. The avg
+   * concurrent request number is calculated as reqPerHour * avgReqLength. To
+   * get the peak of concurrent users, which is what we need, we multiply
+   * that value by a pakReqRatio, which is taken as an integer input parameter 
+   * (-k).
+   */
+  ContentElement* content = chunk->getContent();
+  uint rank = dailyRanking.at(dayIndex).getRankOf(content);
+  if (hour != chunkRateHour) {
+    BOOST_FOREACH (std::vector<int>& rates, chunkRateTable) {
+      rates.assign(rates.size(), 0);
+    }
+    chunkRateHour = hour;
+  }
+  std::vector<int>& rates = chunkRateTable.at(dayIndex * topo->getNumASes() + asid);
+  if (rates.size() != contentRateVec.at(dayIndex).size())
+    rates.resize(contentRateVec.at(dayIndex).size(), 0);
+  if (rates.at(rank) > 0)
+    return rates.at(rank);
+  double rate = contentRateVec.at(dayIndex).at(rank);
+  double avgReqPerHour = (rate * usrPctgByHour.at(hour) / 100) *
+      (topo->getASCustomers(asid) / topo->getNumCustomers());      
+  BOOST_LOG_TRIVIAL(trace) << "avgReqPerHour(" << content->getName() << 
+          ":" << chunk->getIndex() << "," << hour
+          << ") = (" << rate << " * " << usrPctgByHour.at(hour)
+          << " / 100) * (" << topo->getASCustomers(asid) << " / " << topo->getNumCustomers()
+          << ") = " << avgReqPerHour;
+  if (avgReqPerHour < 1) {
+    BOOST_LOG_TRIVIAL(trace) << "avgReqPerHour for chunk " << chunk->getIndex()
+          << " of content " << content->getName()
+          << " is less than 1 (" << avgReqPerHour << "), setting it to 1";
+    avgReqPerHour = 1;
+  }
+  int chunkRate = std::floor((peakReqRatio * avgReqPerHour * (avgReqLength / 3600)) + 0.5);
+  // ensure that the peakReqRatio does not inflate the requests to more than the users we have
+  chunkRate = std::min(chunkRate, static_cast<int>(topo->getASCustomers(asid)));
+  // ensure that we keep at least one copy of each content in each AS
+  chunkRate = std::max(1, chunkRate);
+  BOOST_LOG_TRIVIAL(trace) << "chunkRate = std::floor((" << peakReqRatio 
+          << " * " << avgReqPerHour
+          << " * " << avgReqLength << " / 3600) + 0.5) = " << chunkRate;
+  rates.at(rank) = chunkRate;
+  return chunkRate;
+}
+
+int TopologyOracle::getHourOfDay(SimTime time, uint currentRound) const {
+  int hour = std::floor((time - currentRound * roundDuration) / 3600);
   /* attempting to fix a potential bug in case we enter this function when it's
-  /* midnight of the following day
+   * midnight of the following day
    */
-  if (hour >= usrPctgByHour.size())
+  if (hour >= (int) usrPctgByHour.size())
     hour = usrPctgByHour.size() - 1;
-  IloEnv env;
-  int asid = topo->getAsid(reqUser);
-  try {    
-    IloModel model(env);
-    IloNumVarArray c(env);
-    auto cachedVec = userCacheMap->at(reqUser).getCacheMap();
-    // add a boolean variable for each of the elements cached
-    // char varName[24];
-    for (auto it = cachedVec.begin(); it != cachedVec.end(); it++) {
-      // varName = ((string)("c_" + it->first->getName())).c_str();
-      c.add(IloNumVar(env, 0, 1, ILOINT));
+  return hour;
+}
+
+CachingStamp TopologyOracle::getCachingStamp(PonUser user, int hour, 
+        uint currentRound) const {
+  CachingStamp stamp;
+  const ChunkCache& cache = userCacheMap->at(user);
+  stamp.cacheVersion = cache.getVersion();
+  // only the chunks cached by the user are part of its problem
+  const ChunkVersionMap& versions = chunkVersion.at(topo->getAsid(user));
+  stamp.chunkVersion = 0;
+  const auto& cached = cache.getCacheMap();
+  for (auto it = cached.begin(); it != cached.end(); it++) {
+    ChunkVersionMap::const_iterator vIt = versions.find(it->first.get());
+    if (vIt != versions.end())
+      stamp.chunkVersion += vIt->second;
+  }
+  stamp.rankingVersion = 0;
+  BOOST_FOREACH (const RankingTable<ContentElement*>& ranking, dailyRanking) {
+    stamp.rankingVersion += ranking.getVersion();
+  }
+  stamp.hour = hour;
+  stamp.round = currentRound;
+  return stamp;
+}
+
+CachingVar TopologyOracle::buildCachingVar(PonUser reqUser, const ChunkPtr& chunk,
+        int hour, uint asid, uint currentRound) {
+  CachingVar var;
+  var.chunk = chunk;
+  var.size = chunk->getSize();
+  var.forced = false;
+  var.chunkRate = 0;
+  var.otherUploads = 0;
+  var.ownUploads = 0;
+  uint dayIndex = currentRound - chunk->getContent()->getReleaseDay();
+  assert(0 <= dayIndex && dayIndex < 7);
+  /* if it's a young content (released today and with only a few hours of life)
+   * make sure it is not erased, as ranking is still too volatile to be accurate
+   */
+  if (dayIndex == 0 && hour < 6) {
+    var.forced = true;
+    return var;
+  }
+  var.chunkRate = this->computeChunkRate(chunk, hour, asid, dayIndex);
+  const ChunkCache& reqCache = userCacheMap->at(reqUser);
+  // the upload slots of the requesting user are lost if it does not cache the chunk
+  var.ownUploads = (int) maxUploads - reqCache.getTotalUploads() 
+          + reqCache.getCurrentUploads(chunk);
+  HolderVec holders = this->getSources(chunk, asid);
+  for (auto uit = holders.begin(); uit != holders.end(); uit++) {
+    if (reqUser != *uit) {
+      var.otherUploads += (int) maxUploads - userCacheMap->at(*uit).getTotalUploads()
+              + userCacheMap->at(*uit).getCurrentUploads(chunk);
     }
-    // add a boolean variable for the element requested
-    // varName = ((string)("c_" + content->getName())).c_str();
-    c.add(IloNumVar(env, 0, 1, ILOINT));
-    // Define the constraints
-    IloRangeArray constraints(env);
-    // Initialize the objective function expression
-    IloNumExpr exp(env);
-    // add the size of the elements cached, if kept in the cache
-    int i = 0;
-    for (auto it = cachedVec.begin(); it != cachedVec.end(); it++) {
-      ChunkPtr chunkIt = it->first;
-      ContentElement* contIt = chunkIt->getContent();
-      exp += c[i] * it->second.size;
-      // also make sure that we do not erase a content if we are uploading it
-      if  (it->second.uploads > 0) {
-        constraints.add(c[i] == 1);
-        i++;
-        continue;
-      }
-      // build the constraint on rates if required
-      /* the contentRateVec holds the number of requests expected for each content
-       * per day. To get the number of requests per hour per AS we need
-       * to get the % of requests in this particular hour via usrPctgByHour and
-       * multiply it by the fraction of users in the AS of the requester. The avg
-       * concurrent request number is calculated as reqPerHour * avgReqLength. To
-       * get the peak of concurrent users, which is what we need, we multiply
-       * that value by a pakReqRatio, which is taken as an integer input parameter 
-       * (-k).
-       */
-      uint dayIndex = currentRound - contIt->getReleaseDay();
-      assert(0 <= dayIndex && dayIndex < 7);
-      /* if it's a young content (released today and with only a few hours of life)
-       * make sure it is not erased, as ranking is still too volatile to be accurate
-       */
-      if (dayIndex == 0 && hour < 6) {
-        constraints.add(c[i] == 1);
-        i++;
-        continue;
-      }
-      uint rank = dailyRanking.at(dayIndex).getRankOf(contIt);
-      double rate = contentRateVec.at(dayIndex).at(rank);
-      double avgReqPerHour = (rate * usrPctgByHour.at(hour) / 100) *
-          (topo->getASCustomers(asid) / topo->getNumCustomers());      
-      BOOST_LOG_TRIVIAL(trace) << "avgReqPerHour(" << contIt->getName() << 
-              ":" << chunkIt->getIndex() << "," << hour
-              << ") = (" << rate << " * " << usrPctgByHour.at(hour)
-              << " / 100) * (" << topo->getASCustomers(asid) << " / " << topo->getNumCustomers()
-              << ") = " << avgReqPerHour;
-      if (avgReqPerHour < 1) {
-        BOOST_LOG_TRIVIAL(trace) << "avgReqPerHour for chunk " << chunkIt->getIndex()
-              << " of content " << contIt->getName()
-              << " is less than 1 (" << avgReqPerHour << "), setting it to 1";
-        avgReqPerHour = 1;
-      }
-      int chunkRate = std::floor((peakReqRatio * avgReqPerHour * (avgReqLength / 3600)) + 0.5);
-      // ensure that the peakReqRatio does not inflate the requests to more than the users we have
-      chunkRate = std::min(chunkRate, static_cast<int>(topo->getASCustomers(asid)));
-      // ensure that we keep at least one copy of each content in each AS
-      chunkRate = std::max(1, chunkRate);
-      BOOST_LOG_TRIVIAL(trace) << "chunkRate = std::floor((" << peakReqRatio 
-              << " * " << avgReqPerHour
-              << " * " << avgReqLength << " / 3600) + 0.5) = " << chunkRate;
-      IloNumExpr cExp(env, 0);
-      for (auto uit = asidContentMap->at(asid).at(chunkIt).begin();
-              uit != asidContentMap->at(asid).at(chunkIt).end(); uit++) {
-        if (reqUser != *uit) {
-          cExp += maxUploads - userCacheMap->at(*uit).getTotalUploads()
-                  + userCacheMap->at(*uit).getCurrentUploads(chunkIt);
-        } else {
-          // multiply the term by the caching variable so that we lose it if
-          // we decide to erase the element from the cache
-          cExp += c[i]* (IloInt) (maxUploads - userCacheMap->at(reqUser).getTotalUploads()
-                  + userCacheMap->at(reqUser).getCurrentUploads(chunkIt));
-        }
+  }
+  return var;
+}
+
+/* The upload rate constraint of each chunk only involves the caching variable
+ * of that chunk, since the requesting user is the only one whose cache is
+ * being decided. Hence the problem is separable: dropping every chunk whose
+ * constraint allows it minimizes the size of the cache, and the solution is
+ * feasible if and only if what is left fits in the cache.
+ */
+bool TopologyOracle::solveCaching(const std::vector<CachingVar>& vars,
+        Capacity maxSize, std::vector<bool>& keep) const {
+  keep.assign(vars.size(), false);
+  Capacity totalSize = 0;
+  for (uint i = 0; i < vars.size(); i++) {
+    const CachingVar& var = vars[i];
+    if (var.forced || var.otherUploads < var.chunkRate) {
+      // the chunk has to be cached, provided that this is enough
+      if (!var.forced && var.otherUploads + var.ownUploads < var.chunkRate)
+        return false;
+      keep[i] = true;
+      totalSize += var.size;
+    }
+  }
+  return totalSize <= maxSize;
+}
+
+#ifdef USE_CPLEX
+bool TopologyOracle::solveCachingCplex(PonUser reqUser, 
+        const std::vector<CachingVar>& vars, Capacity maxSize, 
+        std::vector<bool>& keep) {
+  IloEnv env = cplexModels->env;
+  try {
+    CplexUserModel*& um = cplexModels->users[reqUser];
+    if (um == nullptr)
+      um = new CplexUserModel(env, maxSize);
+    CplexASModel*& am = cplexModels->ases[topo->getAsid(reqUser)];
+    if (am == nullptr)
+      am = new CplexASModel(env);
+    if (am->active != um) {
+      // swap the problem of the previous user of the AS with the one of reqUser
+      if (am->active != nullptr) {
+        am->model.remove(am->active->obj);
+        am->model.remove(am->active->size);
+        for (auto it = am->active->vars.begin(); it != am->active->vars.end(); it++)
+          am->model.remove(it->second.rate);
       }
-      constraints.add(cExp >= chunkRate);      
-      i++;
+      am->model.add(um->obj);
+      am->model.add(um->size);
+      for (auto it = um->vars.begin(); it != um->vars.end(); it++)
+        am->model.add(it->second.rate);
+      am->active = um;
     }
-    // same for the chunk we just downloaded
-    exp += c[cachedVec.size()] * chunk->getSize();
-    // add a chunkRate constraint for the downloaded chunk if needed
-    uint dayIndex = currentRound - chunk->getContent()->getReleaseDay();
-    assert(0 <= dayIndex && dayIndex < 7);
-    if (dayIndex == 0 && hour < 6) {
-      constraints.add(c[cachedVec.size()] == 1);
-    } else {
-      uint rank = dailyRanking.at(dayIndex).getRankOf(chunk->getContent());
-      double rate = contentRateVec.at(dayIndex).at(rank);
-      double avgReqPerHour = (rate * usrPctgByHour.at(hour) / 100) *
-              (topo->getASCustomers(asid) / topo->getNumCustomers());
-      BOOST_LOG_TRIVIAL(trace) << "avgReqPerHour(" << chunk->getContent()->getName() 
-              << ":" << chunk->getIndex() << "," << hour
-              << ") = (" << rate << " * " << usrPctgByHour.at(hour)
-              << " / 100) * (" << topo->getASCustomers(asid) << " / " << topo->getNumCustomers()
-              << ") = " << avgReqPerHour;
-      if (avgReqPerHour < 1) {
-        BOOST_LOG_TRIVIAL(trace) << "avgReqPerHour for chunk " << chunk->getIndex()
-              << " of content " << chunk->getContent()->getName()
-              << " is less than 1 (" << avgReqPerHour << "), setting it to 1";
-        avgReqPerHour = 1;
+    um->generation++;
+    um->size.setUB(maxSize);
+    // the current content of the cache plus the new chunk is the MIP start
+    IloNumVarArray c(env);
+    IloNumArray start(env);
+    for (uint i = 0; i < vars.size(); i++) {
+      auto it = um->vars.find(vars[i].chunk.get());
+      if (it == um->vars.end()) {
+        CplexChunkVar var;
+        var.c = IloNumVar(env, 0, 1, ILOINT);
+        var.rate = IloRange(env, -IloInfinity, IloInfinity);
+        am->model.add(var.rate);
+        um->obj.setLinearCoef(var.c, vars[i].size);
+        um->size.setLinearCoef(var.c, vars[i].size);
+        it = um->vars.insert(std::make_pair(vars[i].chunk.get(), var)).first;
       }
-      int chunkRate = std::floor((peakReqRatio * avgReqPerHour * (avgReqLength / 3600)) + 0.5);
-      // ensure that the peakReqRatio does not inflate the requests to more than the users we have
-      chunkRate = std::min(chunkRate, static_cast<int>(topo->getASCustomers(asid)));
-      // ensure that we keep at least one copy of each content in each AS
-      chunkRate = std::max(1, chunkRate);
-      BOOST_LOG_TRIVIAL(trace) << "chunkRate = std::floor((" << peakReqRatio
-              << " * " << avgReqPerHour
-              << " * " << avgReqLength << " / 3600) + 0.5) = " << chunkRate;
-      IloNumExpr cExp(env, 0);
-      for (auto uit = asidContentMap->at(asid).at(chunk).begin();
-              uit != asidContentMap->at(asid).at(chunk).end(); uit++) {
-        if (reqUser != *uit) {
-          cExp += maxUploads - userCacheMap->at(*uit).getTotalUploads()
-                  + userCacheMap->at(*uit).getCurrentUploads(chunk);
-        } else {
-          cExp += c[cachedVec.size()]* (IloInt) (maxUploads - userCacheMap->at(reqUser).getTotalUploads()
-                  + userCacheMap->at(reqUser).getCurrentUploads(chunk));
-        }
+      CplexChunkVar& var = it->second;
+      var.generation = um->generation;
+      if (vars[i].forced) {
+        var.c.setBounds(1, 1);
+        var.rate.setBounds(-IloInfinity, IloInfinity);
+      } else {
+        var.c.setBounds(0, 1);
+        var.rate.setLinearCoef(var.c, vars[i].ownUploads);
+        var.rate.setBounds(vars[i].chunkRate - vars[i].otherUploads, IloInfinity);
       }
-      // if the requesting user was not already caching the content, we must add 
-      // its term to the sum in case we decide to cache the requested content
-      if (userCacheMap->at(reqUser).isCached(chunk) == false) {
-        cExp += c[cachedVec.size()]* (IloInt) (maxUploads - userCacheMap->at(reqUser).getTotalUploads()
-                + userCacheMap->at(reqUser).getCurrentUploads(chunk));
+      c.add(var.c);
+      start.add(1);
+    }
+    // remove the chunks which are not cached anymore from the model
+    for (auto it = um->vars.begin(); it != um->vars.end(); ) {
+      if (it->second.generation != um->generation) {
+        it->second.rate.end();
+        it->second.c.end();
+        it = um->vars.erase(it);
+      } else
+        it++;
+    }
+    if (am->cplex.getNumMIPStarts() > 0)
+      am->cplex.deleteMIPStarts(0, am->cplex.getNumMIPStarts());
+    am->cplex.addMIPStart(c, start);
+    bool solved = am->cplex.solve();
+    if (solved) {
+      IloNumArray vals(env);
+      BOOST_LOG_TRIVIAL(trace) << "Solution status = " << am->cplex.getStatus();
+      BOOST_LOG_TRIVIAL(trace) << "Solution value  = " << am->cplex.getObjValue();
+      am->cplex.getValues(vals, c);
+      BOOST_LOG_TRIVIAL(trace) << "Values        = " << vals;
+      keep.assign(vars.size(), false);
+      for (uint i = 0; i < vars.size(); i++) {
+        keep[i] = (vals[i] > 0.5);
       }
-      constraints.add(cExp >= chunkRate);
+      vals.end();
     }
-    //finally add a constraint on the maximum size of the cache
-    constraints.add(exp <= userCacheMap->at(reqUser).getMaxSize());
-
-    // specify that we are interested in minimizing the objective
-    IloObjective obj = IloMinimize(env, exp);
-    // Add the objectives and the constraints to the model
-    model.add(c);
-    model.add(obj);
-    model.add(constraints);
+    // only the arrays are freed, the variables are still part of the model
+    c.end();
+    start.end();
+    return solved;
+  } catch (IloException& e) {
+    BOOST_LOG_TRIVIAL(warning) << "Concert exception caught: " << e;
+  } 
+  return false; 
+}
+#endif
 
-    // ask CPLEX to solve the problem
-    IloCplex cplex(model);
-    cplex.setOut(env.getNullStream());
-    if (!cplex.solve()) {
+std::pair<bool, bool> TopologyOracle::optimizeCaching(PonUser reqUser, 
+        const ChunkPtr& chunk, SimTime time, uint currentRound) {
+  int hour = this->getHourOfDay(time, currentRound);
+  int asid = topo->getAsid(reqUser);
+  const ChunkCache& reqCache = userCacheMap->at(reqUser);
+  std::vector<CachingVar>& vars = cachingVars;
+  std::vector<bool>& keep = cachingKeep;
+  vars.clear();
+  auto sIt = cachingStamps.find(reqUser);
+  if (sIt != cachingStamps.end() 
+          && sIt->second == this->getCachingStamp(reqUser, hour, currentRound)) {
+    /* the last solution kept all the chunks cached now, and none of its inputs
+     * changed since: the only decision left is whether the new chunk fits
+     */
+    vars.push_back(this->buildCachingVar(reqUser, chunk, hour, asid, currentRound));
+    if (!this->solveCaching(vars, reqCache.getMaxSize() - reqCache.getCurrentSize(), keep)) {
       BOOST_LOG_TRIVIAL(trace) << "Failed to optimize caching for chunk " <<
               chunk->getIndex() << " of content " << 
               chunk->getContent()->getName() << " at user " << reqUser.first << "," <<
               reqUser.second << "; reverting to standard cache policies";
-      env.end();
-      return std::make_pair(false, false); 
+      return std::make_pair(false, false);
     }
-    
-    IloNumArray vals(env);
-    BOOST_LOG_TRIVIAL(trace) << "Solution status = " << cplex.getStatus();
-    BOOST_LOG_TRIVIAL(trace) << "Solution value  = " << cplex.getObjValue();
-    cplex.getValues(vals, c);
-    BOOST_LOG_TRIVIAL(trace) << "Values        = " << vals;
-    
-    // check if any element has to be deleted from the cache
-    i = 0;
-    for (auto it = cachedVec.begin(); it != cachedVec.end(); it++) {
-      if (vals[i] == 0) {
-        userCacheMap->at(reqUser).removeFromCache(it->first, absTime);
-        // also delete the user from the content map
-        removeFromCMap(it->first, reqUser);
-      }
-      i++;
+    return std::make_pair(true, keep.back());
+  }
+  const auto& cachedVec = reqCache.getCacheMap();
+  // one variable for each of the elements cached, plus one for the element requested
+  for (auto it = cachedVec.begin(); it != cachedVec.end(); it++) {
+    // make sure that we do not erase a content if we are uploading it
+    if (it->second.uploads > 0) {
+      CachingVar var;
+      var.chunk = it->first;
+      var.size = it->second.size;
+      var.forced = true;
+      var.chunkRate = var.otherUploads = var.ownUploads = 0;
+      vars.push_back(var);
+    } else {
+      vars.push_back(this->buildCachingVar(reqUser, it->first, hour, asid, 
+              currentRound));
+      vars.back().size = it->second.size;
     }
-    // check if reqContent has to be added to the cache
-    bool shouldCache = (vals[cachedVec.size()] == 1);
-    env.end();
-    return std::make_pair(true, shouldCache);
-    /*
-    // print the new content of the cache for debugging purposes
-    cachedVec = caches[reqUser].getCachedVec();
-    cout << "Cache content after optimization: " ;
-    for (auto it = cachedVec.begin(); it != cachedVec.end(); it++)
-      cout << *it << " ";
-    cout << endl << "Total size: " << caches[reqUser].getCurrentSize() << endl;
-     * */
-  } catch (IloException& e) {
-    BOOST_LOG_TRIVIAL(warning) << "Concert exception caught: " << e;
-  } 
-  env.end();
-  return std::make_pair(false, false); 
+  }
+  vars.push_back(this->buildCachingVar(reqUser, chunk, hour, asid, currentRound));
+  bool solved;
+#ifdef USE_CPLEX
+  if (cachingOpt == CPLEX_SOLVER)
+    solved = this->solveCachingCplex(reqUser, vars, 
+            userCacheMap->at(reqUser).getMaxSize(), keep);
+  else
+#endif
+  solved = this->solveCaching(vars, userCacheMap->at(reqUser).getMaxSize(), keep);
+  if (!solved) {
+    BOOST_LOG_TRIVIAL(trace) << "Failed to optimize caching for chunk " <<
+            chunk->getIndex() << " of content " << 
+            chunk->getContent()->getName() << " at user " << reqUser.first << "," <<
+            reqUser.second << "; reverting to standard cache policies";
+    return std::make_pair(false, false); 
+  }
+  // check if any element has to be deleted from the cache
+  for (uint i = 0; i + 1 < vars.size(); i++) {
+    if (!keep[i]) {
+      userCacheMap->at(reqUser).removeFromCache(vars[i].chunk, time);
+      // also delete the user from the content map
+      removeFromCMap(vars[i].chunk, reqUser);
+    }
+  }
+  // check if reqContent has to be added to the cache
+  return std::make_pair(true, keep.back());
 }
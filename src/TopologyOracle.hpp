@@ -15,6 +15,8 @@
 #include "Cache.hpp"
 #include "RankingTable.hpp"
 #include <unordered_set>
+#include <unordered_map>
+#include <boost/container/small_vector.hpp>
 
 
 /** Percentage of requests taking places at a given hour, starting from midnight. Used to model realistic usage patterns. */
@@ -33,11 +35,84 @@ const std::vector<double> sessionLength = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.
         1, 1, 1, 1, 1, 1, 1, 1}; // 50% linear zapping, 50% entire content 
 
 typedef Cache<ChunkPtr, Capacity, SimTime> ChunkCache;
-typedef std::map<ChunkPtr, std::set<PonUser> > ChunkMap;
-typedef std::map<uint, ChunkMap> AsidContentMap;
+/**
+ * The PonUsers of an AS which are caching a chunk. Most chunks only have a 
+ * handful of holders in each AS, which are stored inline without allocating.
+ */
+typedef boost::container::small_vector<PonUser, 4> HolderVec;
+/**
+ * The holders of each chunk within an AS, keyed by the address of the chunk,
+ * which does not change while it is in the catalog. An entry is only created 
+ * when a chunk gets its first holder and is erased when it loses the last one.
+ */
+typedef std::unordered_map<const ContentChunk*, HolderVec> ChunkMap;
+typedef std::vector<ChunkMap> AsidContentMap;
+/**
+ * For each chunk with at least one holder, which ASes have a holder for it,
+ * indexed by asid.
+ */
+typedef std::unordered_map<const ContentChunk*, std::vector<bool> > ChunkPresenceMap;
+/**
+ * The version of each chunk with at least one holder within an AS, keyed like
+ * the ChunkMap of the AS.
+ */
+typedef std::unordered_map<const ContentChunk*, unsigned long> ChunkVersionMap;
 typedef std::map<PonUser, ChunkCache> UserCacheMap;
 typedef std::map<Vertex, ChunkCache> LocalCacheMap;
 
+/**
+ * The state of the inputs of the cache optimization problem of a user after
+ * its last successful solution, taken once the new chunk has been cached. If 
+ * none of them has changed, all the chunks in the cache of the user would be
+ * kept again.
+ * @see TopologyOracle::optimizeCaching()
+ */
+struct CachingStamp {
+  unsigned long cacheVersion; /**< The version of the cache of the user. */
+  unsigned long chunkVersion; /**< The sum of the versions of the chunks cached by the user, in its AS. */
+  unsigned long rankingVersion; /**< The sum of the versions of the daily rankings. */
+  int hour; /**< The hour of the day used to estimate the request rates. */
+  uint round; /**< The simulation round, which determines the age of the contents. */
+  
+  bool operator==(const CachingStamp& other) const {
+    return cacheVersion == other.cacheVersion && chunkVersion == other.chunkVersion
+            && rankingVersion == other.rankingVersion && hour == other.hour
+            && round == other.round;
+  }
+};
+
+#ifdef USE_CPLEX
+/**
+ * The CPLEX environment, the cache optimization model of each AS and the 
+ * variables of each user, kept across calls to TopologyOracle::optimizeCaching(). Defined in 
+ * TopologyOracle.cpp, so that CPLEX headers are not needed elsewhere.
+ */
+struct CplexCachingModels;
+#endif
+
+/**
+ * The algorithm used by TopologyOracle::optimizeCaching() to decide which
+ * chunks a user should keep in its cache. CPLEX_SOLVER is only available if
+ * PLACeS was compiled with USE_CPLEX defined (and linked against ILOCPLEX).
+ */
+enum CachingSolver {NO_CACHING_OPT, BUILTIN_SOLVER, CPLEX_SOLVER};
+
+/**
+ * A binary variable of the cache optimization problem, telling whether a 
+ * chunk should be kept in (or added to) the cache of the requesting user. 
+ * Unless the chunk is forced into the cache, its upload rate constraint is
+ * otherUploads + ownUploads * c >= chunkRate. 
+ * @see TopologyOracle::optimizeCaching()
+ */
+struct CachingVar {
+  ChunkPtr chunk; /**< The chunk this variable refers to. */
+  Capacity size; /**< The storage space taken by the chunk, i.e., the weight of the variable in the objective function. */
+  bool forced; /**< If true, the chunk must be cached, e.g., because it is being uploaded or because it is too young to estimate its popularity. */
+  int chunkRate; /**< The peak number of concurrent requests for the chunk expected in the AS. */
+  int otherUploads; /**< The upload slots for the chunk available at the other holders in the AS. */
+  int ownUploads; /**< The upload slots for the chunk that the requesting user provides if it caches it. */
+};
+
 /**
  * This struct condenses statistical measures of a number of metrics related
  * to the current simulation. Each vector has as many elements as the number
@@ -133,7 +208,11 @@ protected:
   uint peakReqRatio; /**< Multiplicative factor used to determine peak requests from average requests. */
   uint bitrate; /**< Bitrate of the encoded content in Mbps. */
   Topology* topo; /**< Pointer to the Topology being used for this simulation. */
-  AsidContentMap* asidContentMap; /**< A map keeping track of the items available in each Access Section (AS). */
+  AsidContentMap* asidContentMap; /**< The holders of the chunks available in each Access Section (AS), indexed by asid. */
+  ChunkPresenceMap chunkPresence; /**< The ASes in which each chunk has at least one holder, kept consistent with asidContentMap. Used to skip the ASes without sources when looking for a remote peer. */
+  std::vector<ChunkVersionMap> chunkVersion; /**< For each AS, the version of each chunk with holders in the AS, which changes whenever the holders of the chunk or their uploads change. */
+  unsigned long lastChunkVersion; /**< The last version assigned to a chunk; versions are never reused, so that the sum of the versions of a set of chunks only grows. */
+  std::map<PonUser, CachingStamp> cachingStamps; /**< The CachingStamp of each user after its last successful cache optimization. */
   UserCacheMap* userCacheMap; /**< A map keeping track of the items available at each user. */
   LocalCacheMap* localCacheMap; /**< A map keeping track of the items available in each CDN cache. */
   uint ponCardinality; /**< Number of users per PON. */
@@ -146,8 +225,16 @@ protected:
   uint maxUploads;  /**< Maximum number of concurrent uploads per PON tree. Used for the cache optimization problem. @see TopologyOracle::optimizeCaching() */
   std::vector< std::vector<double> > contentRateVec; /**< A vector which associates to each release day and popularity rank the number of requests that the oracle expects to observe per user per day. */
   std::vector<RankingTable<ContentElement*> > dailyRanking; /**< A bimap-based container to keep track of the dynamic evolution of content popularity. */
+  std::vector<std::vector<int> > chunkRateTable; /**< The values returned by computeChunkRate() for chunkRateHour, indexed by dayIndex * (number of ASes) + asid and by rank; 0 if not computed yet. */
+  int chunkRateHour; /**< The hour of the day chunkRateTable refers to, or -1 if it has to be recomputed. */
   uint roundDuration; /**< Length of a simulation round in seconds. */
-  bool cachingOpt; /**< If true, attempts to optimize the storage space utilization of the user caches. @see TopologyOracle::optimizeCaching() */
+  CachingSolver cachingOpt; /**< Unless NO_CACHING_OPT, the solver used to optimize the storage space utilization of the user caches. @see TopologyOracle::optimizeCaching() */
+  bool periodicCachingOpt; /**< If true, the user caches are optimized periodically by optimizeCaches(), and completed chunks are always cached according to the cache policy. */
+  std::vector<CachingVar> cachingVars; /**< The variables of the last cache optimization problem, kept to reuse their storage. */
+  std::vector<bool> cachingKeep; /**< The solution of the last cache optimization problem, kept to reuse its storage. */
+#ifdef USE_CPLEX
+  CplexCachingModels* cplexModels; /**< One CPLEX model per AS and the variables of the users whose caches have been optimized, updated incrementally at each call. Only allocated with CPLEX_SOLVER. */
+#endif
   
   uint chunkSize; /**< size of a Chunk in Megabits. Note that the last chunk of a ContentElement can be smaller than this. */
   uint bufferSize; /**< Number of chunks that can be prefetched in the user buffer for streaming purposes, once a content has been requested. */
@@ -215,13 +302,14 @@ public:
   /**
    * Retrieves the set of local sources for a given chunk.
    * 
-   * This utility method returns a std::set of PonUsers residing in Access Section
-   * (AS) asid and who are currently caching a copy of chunk.
+   * This utility method returns the PonUsers residing in Access Section
+   * (AS) asid and who are currently caching a copy of chunk, in no particular
+   * order.
    * @param chunk The chunk we are looking for sources of.
    * @param asid The id of the AS in which the sources should reside.
-   * @return A std::set of PonUsers local to AS asid and with a copy of chunk.
+   * @return The PonUsers local to AS asid and with a copy of chunk.
    */
-  std::set<PonUser> getSources(const ChunkPtr& chunk, uint asid);
+  HolderVec getSources(const ChunkPtr& chunk, uint asid) const;
   
   /**
    * Performs all the required post-completion operations on a Flow.
@@ -320,16 +408,46 @@ public:
    */
   void getFromLocalCache(Vertex lCache, const ChunkPtr& chunk, SimTime time);
   
+  /**
+   * Picks a random holder of chunk in Access Section (AS) asid, among those
+   * whose route to destination is not congested.
+   * 
+   * Holders are drawn uniformly at random without replacement, directly from
+   * the content map, until a viable one is found.
+   * @param chunk The chunk that has been requested.
+   * @param asid The id of the AS in which the source should reside.
+   * @param destination The user requesting chunk.
+   * @return A viable source for chunk, or UNKNOWN if there is none in the AS.
+   */
+  PonUser findRandomSource(const ChunkPtr& chunk, uint asid, PonUser destination);
+  
+  /**
+   * Adds user to the content map for chunk, unless it is already there.
+   * 
+   * This method should be called after chunk has been added to user's cache.
+   * @param chunk The chunk that has just been cached.
+   * @param user The user that should be added to the content map.
+   */
+  void addToCMap(const ChunkPtr& chunk, PonUser user);
+  
   /**
    * Removes user from the content map for chunk.
    * 
    * This method should be called after chunk has been deleted from user's cache,
-   * to update the map that matches chunks with local sources.
+   * to update the map that matches chunks with local sources. The entry of
+   * chunk is erased once its last holder in the AS is removed.
    * @param chunk The chunk that has just been deleted.
    * @param user The user that should be removed from the content map.
    */
   void removeFromCMap(const ChunkPtr& chunk, PonUser user);
   
+  /**
+   * Assigns a new version to each chunk cached by user, since the upload slots
+   * it can offer for them changed.
+   * @param user The user whose uploads changed.
+   */
+  void touchHolder(PonUser user);
+  
   /**
    * Method to optimize the storage utilization of user caches.
    * 
@@ -339,10 +457,13 @@ public:
    * the function should be called before adding elements to the cache, as it 
    * determines whether or not the new element is worth storing and which 
    * elements should be erased to make space for it. 
+   * If nothing the problem depends on changed since the last solution for 
+   * the same user (see CachingStamp), the cached chunks would all be kept
+   * again, hence only the variable of the new chunk is evaluated.
    * 
    * @param user The user whose cache we are trying to optimize.
    * @param chunk The chunk that user has just finished downloading.
-   * @param time The current simulation time, used to calculate the hour of the day.
+   * @param time The current (absolute) simulation time, used to calculate the hour of the day.
    * @param currentRound The current simulation round, used to compute the age of the cached content (i.e., the days elapsed since their first release).
    * 
    * @return A std::pair<bool,bool>, the first of which tells the caller whether
@@ -353,6 +474,92 @@ public:
   std::pair<bool, bool> optimizeCaching(PonUser user, const ChunkPtr& chunk, 
       SimTime time, uint currentRound);
   
+  /**
+   * Optimizes the storage utilization of all the user caches at once.
+   * 
+   * This method is invoked by the Scheduler when a FlowType::OPTIMIZE is 
+   * encountered. For each chunk in each Access Section (AS), it keeps the 
+   * fewest copies whose upload slots cover the peak request rate estimated
+   * for the chunk, and erases the others; copies being uploaded are never
+   * erased. Chunks are added to the caches by the cache policy in between.
+   * @param time The current (absolute) simulation time, used to calculate the hour of the day.
+   * @param currentRound The current simulation round.
+   */
+  void optimizeCaches(SimTime time, uint currentRound);
+  
+  /**
+   * Computes the hour of the day used to estimate the request rates.
+   * @param time The current (absolute) simulation time.
+   * @param currentRound The current simulation round.
+   * @return The hour of the day, capped to the last hour of usrPctgByHour.
+   */
+  int getHourOfDay(SimTime time, uint currentRound) const;
+  
+  /**
+   * Builds the CachingStamp of a user from the current state of its cache,
+   * of the holders of its chunks in its AS and of the daily rankings.
+   * @param user The user whose cache is being optimized.
+   * @param hour The current hour of the day.
+   * @param currentRound The current simulation round.
+   * @return The current CachingStamp of user.
+   */
+  CachingStamp getCachingStamp(PonUser user, int hour, uint currentRound) const;
+  
+  /**
+   * Estimates the peak number of concurrent requests for a chunk in an Access
+   * Section (AS), based on the popularity of its content. The estimate only 
+   * depends on the rank of the content, and is memoized in chunkRateTable
+   * until the hour changes or the rates are updated at the end of the round.
+   * @param chunk The chunk whose request rate is being estimated.
+   * @param hour The current hour of the day.
+   * @param asid The id of the AS.
+   * @param dayIndex The number of days elapsed since the release of the content.
+   * @return The expected peak of concurrent requests for chunk, at least 1.
+   */
+  int computeChunkRate(const ChunkPtr& chunk, int hour, uint asid, uint dayIndex);
+  
+  /**
+   * Builds the variable of the cache optimization problem for a chunk, 
+   * including its upload rate constraint.
+   * @param reqUser The user whose cache is being optimized.
+   * @param chunk The chunk the variable refers to.
+   * @param hour The current hour of the day.
+   * @param asid The id of the AS of reqUser.
+   * @param currentRound The current simulation round.
+   * @return The variable for chunk; its size is that of the chunk.
+   */
+  CachingVar buildCachingVar(PonUser reqUser, const ChunkPtr& chunk, int hour,
+      uint asid, uint currentRound);
+  
+  /**
+   * Solves the cache optimization problem exactly, minimizing the storage 
+   * space taken by the chunks kept in the cache subject to their upload rate
+   * constraints and to the cache size. Runs in linear time, as the constraint
+   * of each chunk only involves its own variable.
+   * @param vars The variables of the problem.
+   * @param maxSize The size of the cache.
+   * @param keep Filled with the value of each variable in the optimal solution.
+   * @return True if the problem is feasible, false otherwise.
+   */
+  bool solveCaching(const std::vector<CachingVar>& vars, Capacity maxSize,
+      std::vector<bool>& keep) const;
+  
+#ifdef USE_CPLEX
+  /**
+   * Solves the cache optimization problem with CPLEX. 
+   * 
+   * The variables of each user are kept between calls: those of the chunks
+   * which left the cache are removed, those of new chunks are added and the 
+   * coefficients of the others are updated. The users of an AS share a single
+   * model and CPLEX instance, which hold the variables of one user at a time.
+   * The current content of the cache is given to CPLEX as a MIP start.
+   * @param reqUser The user whose cache is being optimized.
+   * @see solveCaching()
+   */
+  bool solveCachingCplex(PonUser reqUser, const std::vector<CachingVar>& vars,
+      Capacity maxSize, std::vector<bool>& keep);
+#endif
+  
   /**
    * Print a graphml snapshot of the current status of the network.
    * 
@@ -166,12 +166,13 @@ void VoDTopologyOracle::scheduleRequests(std::list<ContentElement*> list,
       assert(topo->getPonCustomers(ponNodes.at(i - 1)) > randUser - oldt);
       randPonUser = std::make_pair(ponNodes.at(i - 1), randUser - oldt);
       // generate a random request time
-      SimTime reqTime = dayDist(gen) * 86400 + // day
+      SimTime reqTime = scheduler->getRoundStart() + // time is absolute
+              dayDist(gen) * 86400 + // day
               hourDist(gen) * 3600 + // hour
               minSecDist(gen); // minutes and seconds
       // generate request
       // TODO: Add support for zapping in VoD too.
-      Flow* req = new Flow(content, randPonUser, reqTime);
+      Flow* req = scheduler->createFlow(content, randPonUser, reqTime);
       scheduler->schedule(req);        
     }
     assignedUsers.clear();
@@ -5,7 +5,7 @@
  * Created on 30-Apr-2013, 14:18:22
  */
 
-#include "CacheTestClass.hpp"
+#include "CacheTest.hpp"
 #include "Cache.hpp"
 
 
@@ -37,35 +37,31 @@ void CacheTestClass::testAddToCache() {
       CPPUNIT_ASSERT(result.first == true);
       CPPUNIT_ASSERT(result.second.empty());
       CPPUNIT_ASSERT(cache.getCurrentSize() == i + 1);
-      CPPUNIT_ASSERT(cache.isCached(i, 1));
+      CPPUNIT_ASSERT(cache.isCached(i));
     }
     // test invariance of maxSize
     CPPUNIT_ASSERT(cache.getMaxSize() == 5);
     // test failure of searching for a non-cached element
-    CPPUNIT_ASSERT(!cache.isCached(10, 1));
-    // test failure of searching for a cached element with a bigger size
-    CPPUNIT_ASSERT(!cache.isCached(0, 5));
-    // test success of searching for a cached element with a smaller size
-    CPPUNIT_ASSERT(cache.isCached(1, 0));
+    CPPUNIT_ASSERT(!cache.isCached(10));
     // test addToCache when the cache is full (content 0 will be evicted)
     result = cache.addToCache(5, 1, 5);
     CPPUNIT_ASSERT(result.first);
     CPPUNIT_ASSERT(!result.second.empty());
-    CPPUNIT_ASSERT(cache.isCached(5, 1));
-    CPPUNIT_ASSERT(!cache.isCached(0, 1));
+    CPPUNIT_ASSERT(cache.isCached(5));
+    CPPUNIT_ASSERT(!cache.isCached(0));
     CPPUNIT_ASSERT(cache.getCurrentSize() == cache.getMaxSize());
     CPPUNIT_ASSERT(cache.getMaxSize() == 5);
     // test cache removal
-    cache.removeFromCache(4);
+    cache.removeFromCache(4, 5);
     CPPUNIT_ASSERT(cache.getMaxSize() == 5);
     CPPUNIT_ASSERT(cache.getCurrentSize() == cache.getMaxSize() - 1);
-    CPPUNIT_ASSERT(!cache.isCached(4, 1));
+    CPPUNIT_ASSERT(!cache.isCached(4));
     // test cache fetching (and related fields update)
-    CPPUNIT_ASSERT(cache.getFromCache(1, 6));
+    CPPUNIT_ASSERT(cache.getFromCache(1, 6, true));
     CPPUNIT_ASSERT(cache.cacheMap.at(1).lastAccessed == 6);
     CPPUNIT_ASSERT(cache.cacheMap.at(1).timesServed == 1);
     // test failed cache fetching
-    CPPUNIT_ASSERT(!cache.getFromCache(4, 7));
+    CPPUNIT_ASSERT(!cache.getFromCache(4, 7, true));
     // test adding element which is already cached with same size
     result = cache.addToCache(2,1,8);
     CPPUNIT_ASSERT(result.first == false);
@@ -80,8 +76,225 @@ void CacheTestClass::testAddToCache() {
     cache.clearCache();
     CPPUNIT_ASSERT(cache.getCurrentSize() == 0);
     CPPUNIT_ASSERT(cache.getMaxSize() == 5);
-    CPPUNIT_ASSERT(cache.isCached(2, 1) == 0);
+    CPPUNIT_ASSERT(cache.isCached(2) == 0);
   }
   
 }
 
+void CacheTestClass::testLruEvictionOrder() {
+  Cache<int, int, int> cache(3, LRU);
+  for (int i = 0; i < 3; i++)
+    cache.addToCache(i, 1, i);
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({0, 1, 2}));
+  // a hit moves the item to the most recently used end
+  cache.getFromCache(0, 3, true);
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({1, 2, 0}));
+  std::pair<bool, std::set<int> > result = cache.addToCache(3, 1, 4);
+  CPPUNIT_ASSERT(result.first);
+  CPPUNIT_ASSERT(result.second == std::set<int>({1}));
+  cache.getFromCache(2, 5, true);
+  result = cache.addToCache(4, 1, 6);
+  CPPUNIT_ASSERT(result.second == std::set<int>({0}));
+  result = cache.addToCache(5, 1, 7);
+  CPPUNIT_ASSERT(result.second == std::set<int>({3}));
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({2, 4, 5}));
+  // a bigger item evicts as many items as needed, oldest first
+  result = cache.addToCache(6, 2, 8);
+  CPPUNIT_ASSERT(result.second == std::set<int>({2, 4}));
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({5, 6}));
+  // removed items leave the recency list
+  cache.removeFromCache(5, 9);
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({6}));
+  CPPUNIT_ASSERT(cache.getCurrentSize() == 2);
+}
+
+void CacheTestClass::testLruPinnedEntries() {
+  Cache<int, int, int> cache(3, LRU);
+  for (int i = 0; i < 3; i++)
+    cache.addToCache(i, 1, i);
+  // 0 is being uploaded twice, so it leaves the recency list
+  cache.getFromCache(0, 3, false);
+  cache.getFromCache(0, 4, false);
+  cache.getFromCache(1, 5, true);
+  cache.getFromCache(2, 6, true);
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({1, 2}));
+  std::pair<bool, std::set<int> > result = cache.addToCache(3, 1, 7);
+  CPPUNIT_ASSERT(result.first);
+  CPPUNIT_ASSERT(result.second == std::set<int>({1}));
+  CPPUNIT_ASSERT(cache.isCached(0));
+  // once all its uploads are over, 0 is back as the most recently used item
+  cache.uploadCompleted(0);
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({2, 3}));
+  cache.uploadCompleted(0);
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({2, 3, 0}));
+  result = cache.addToCache(4, 2, 8);
+  CPPUNIT_ASSERT(result.second == std::set<int>({2, 3}));
+  CPPUNIT_ASSERT(lruOrder(cache) == std::vector<int>({0, 4}));
+  // nothing can be replaced if all the items are being uploaded
+  cache.getFromCache(0, 9, false);
+  cache.getFromCache(4, 9, false);
+  CPPUNIT_ASSERT(lruOrder(cache).empty());
+  result = cache.addToCache(5, 1, 10);
+  CPPUNIT_ASSERT(!result.first);
+  CPPUNIT_ASSERT(result.second.empty());
+  CPPUNIT_ASSERT(cache.getNumElementsCached() == 2);
+  CPPUNIT_ASSERT(!cache.isCached(5));
+}
+
+void CacheTestClass::testLruCopy() {
+  Cache<int, int, int>* original = new Cache<int, int, int>(4, LRU);
+  for (int i = 0; i < 4; i++)
+    original->addToCache(i, 1, i);
+  original->getFromCache(0, 4, true);
+  original->getFromCache(2, 5, false);
+  Cache<int, int, int> copy(*original);
+  Cache<int, int, int> assigned(1, LRU);
+  assigned.addToCache(9, 1, 0);
+  assigned = *original;
+  CPPUNIT_ASSERT(lruOrder(copy) == lruOrder(*original));
+  CPPUNIT_ASSERT(lruOrder(assigned) == lruOrder(*original));
+  // the copies must evict the same items as the original
+  std::set<int> evicted = original->addToCache(4, 2, 6).second;
+  CPPUNIT_ASSERT(evicted == std::set<int>({1, 3}));
+  CPPUNIT_ASSERT(copy.addToCache(4, 2, 6).second == evicted);
+  CPPUNIT_ASSERT(assigned.addToCache(4, 2, 6).second == evicted);
+  // and their recency lists must not depend on the original
+  delete original;
+  CPPUNIT_ASSERT(lruOrder(copy) == std::vector<int>({0, 4}));
+  CPPUNIT_ASSERT(copy.addToCache(5, 1, 7).second == std::set<int>({0}));
+  CPPUNIT_ASSERT(assigned.addToCache(5, 1, 7).second == std::set<int>({0}));
+  // the upload of 2 was copied as well
+  CPPUNIT_ASSERT(copy.addToCache(6, 1, 8).second == std::set<int>({4}));
+  CPPUNIT_ASSERT(assigned.addToCache(6, 1, 8).second == std::set<int>({4}));
+  copy.uploadCompleted(2);
+  assigned.uploadCompleted(2);
+  CPPUNIT_ASSERT(lruOrder(copy) == std::vector<int>({5, 6, 2}));
+  CPPUNIT_ASSERT(lruOrder(copy) == lruOrder(assigned));
+}
+
+void CacheTestClass::testLfuVictim() {
+  Cache<int, int, int> cache(3, LFU);
+  for (int i = 0; i < 3; i++)
+    cache.addToCache(i, 1, i);
+  cache.getFromCache(0, 3, true);
+  cache.getFromCache(0, 4, true);
+  cache.getFromCache(1, 5, true);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({2, 1, 0}));
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+  // the least frequently used item goes, however recently it was added
+  std::pair<bool, std::set<int> > result = cache.addToCache(3, 1, 6);
+  CPPUNIT_ASSERT(result.first);
+  CPPUNIT_ASSERT(result.second == std::set<int>({2}));
+  result = cache.addToCache(4, 1, 7);
+  CPPUNIT_ASSERT(result.second == std::set<int>({3}));
+  // served as often as 1, but 4 was used less recently
+  cache.getFromCache(4, 8, true);
+  cache.getFromCache(1, 9, true);
+  cache.getFromCache(0, 10, true);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({4, 1, 0}));
+  result = cache.addToCache(5, 2, 11);
+  CPPUNIT_ASSERT(result.second == std::set<int>({4, 1}));
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({5, 0}));
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+  // removing the last item of a bucket frees the bucket
+  cache.removeFromCache(5, 12);
+  CPPUNIT_ASSERT(cache.freqBuckets.size() == 1);
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+}
+
+void CacheTestClass::testLfuTieBreaking() {
+  Cache<int, int, int> cache(3, LFU);
+  for (int i = 0; i < 3; i++)
+    cache.addToCache(i, 1, i);
+  // ties are broken by recency, both when added and when served
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({0, 1, 2}));
+  cache.getFromCache(2, 3, true);
+  cache.getFromCache(0, 4, true);
+  cache.getFromCache(1, 5, true);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({2, 0, 1}));
+  std::pair<bool, std::set<int> > result = cache.addToCache(3, 1, 6);
+  CPPUNIT_ASSERT(result.second == std::set<int>({2}));
+  cache.getFromCache(3, 7, true);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({0, 1, 3}));
+  result = cache.addToCache(4, 1, 8);
+  CPPUNIT_ASSERT(result.second == std::set<int>({0}));
+  // an item cached again with a bigger size keeps its frequency
+  result = cache.addToCache(1, 2, 9);
+  CPPUNIT_ASSERT(result.first);
+  CPPUNIT_ASSERT(result.second == std::set<int>({4}));
+  CPPUNIT_ASSERT(cache.cacheMap.at(1).timesServed == 1);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({3, 1}));
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+}
+
+void CacheTestClass::testLfuPinnedEntries() {
+  Cache<int, int, int> cache(3, LFU);
+  for (int i = 0; i < 3; i++)
+    cache.addToCache(i, 1, i);
+  cache.getFromCache(1, 3, true);
+  cache.getFromCache(1, 4, true);
+  cache.getFromCache(2, 5, true);
+  cache.getFromCache(2, 6, true);
+  // 0 is being uploaded, alone in its bucket
+  cache.getFromCache(0, 7, false);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({1, 2}));
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+  std::pair<bool, std::set<int> > result = cache.addToCache(3, 1, 8);
+  CPPUNIT_ASSERT(result.first);
+  CPPUNIT_ASSERT(result.second == std::set<int>({1}));
+  // items served while being uploaded stay out of the lists
+  cache.getFromCache(0, 9, false);
+  cache.getFromCache(3, 10, true);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({3, 2}));
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+  // 0 can only be replaced once all its uploads are over
+  cache.uploadCompleted(0);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({3, 2}));
+  cache.uploadCompleted(0);
+  CPPUNIT_ASSERT(lfuOrder(cache) == std::vector<int>({3, 2, 0}));
+  result = cache.addToCache(4, 3, 11);
+  CPPUNIT_ASSERT(result.second == std::set<int>({3, 2, 0}));
+  CPPUNIT_ASSERT(bucketsConsistent(cache));
+  // nothing can be replaced if all the items are being uploaded
+  cache.getFromCache(4, 12, false);
+  result = cache.addToCache(5, 1, 13);
+  CPPUNIT_ASSERT(!result.first);
+  CPPUNIT_ASSERT(result.second.empty());
+  CPPUNIT_ASSERT(cache.isCached(4));
+}
+
+void CacheTestClass::testLfuCopy() {
+  Cache<int, int, int>* original = new Cache<int, int, int>(4, LFU);
+  for (int i = 0; i < 4; i++)
+    original->addToCache(i, 1, i);
+  original->getFromCache(0, 4, true);
+  original->getFromCache(0, 5, true);
+  original->getFromCache(1, 6, true);
+  original->getFromCache(3, 7, false);
+  Cache<int, int, int> copy(*original);
+  Cache<int, int, int> assigned(2, LFU);
+  assigned.addToCache(9, 1, 0);
+  assigned.getFromCache(9, 1, true);
+  assigned = *original;
+  // the buckets are rebuilt, not shared with the original
+  CPPUNIT_ASSERT(lfuOrder(copy) == lfuOrder(*original));
+  CPPUNIT_ASSERT(lfuOrder(assigned) == lfuOrder(*original));
+  CPPUNIT_ASSERT(bucketsConsistent(copy));
+  CPPUNIT_ASSERT(bucketsConsistent(assigned));
+  CPPUNIT_ASSERT(copy.cacheMap.at(0).bucket != original->cacheMap.at(0).bucket);
+  // the copies must evict the same items as the original
+  std::set<int> evicted = original->addToCache(4, 2, 8).second;
+  CPPUNIT_ASSERT(evicted == std::set<int>({2, 1}));
+  CPPUNIT_ASSERT(copy.addToCache(4, 2, 8).second == evicted);
+  CPPUNIT_ASSERT(assigned.addToCache(4, 2, 8).second == evicted);
+  delete original;
+  // including the upload of 3, once it is over
+  copy.uploadCompleted(3);
+  assigned.uploadCompleted(3);
+  CPPUNIT_ASSERT(lfuOrder(copy) == std::vector<int>({4, 3, 0}));
+  CPPUNIT_ASSERT(copy.addToCache(5, 2, 9).second == std::set<int>({4}));
+  CPPUNIT_ASSERT(assigned.addToCache(5, 2, 9).second == std::set<int>({4}));
+  CPPUNIT_ASSERT(lfuOrder(copy) == lfuOrder(assigned));
+  CPPUNIT_ASSERT(bucketsConsistent(copy));
+  CPPUNIT_ASSERT(bucketsConsistent(assigned));
+}
@@ -9,23 +9,86 @@
 #define	CACHETEST_HPP
 
 #include <cppunit/extensions/HelperMacros.h>
+#include <vector>
 
-class CacheTest : public CPPUNIT_NS::TestFixture {
-  CPPUNIT_TEST_SUITE(CacheTest);
+// the name must match the friend declaration in Cache
+class CacheTestClass : public CPPUNIT_NS::TestFixture {
+  CPPUNIT_TEST_SUITE(CacheTestClass);
 
   CPPUNIT_TEST(testAddToCache);
+  CPPUNIT_TEST(testLruEvictionOrder);
+  CPPUNIT_TEST(testLruPinnedEntries);
+  CPPUNIT_TEST(testLruCopy);
+  CPPUNIT_TEST(testLfuVictim);
+  CPPUNIT_TEST(testLfuTieBreaking);
+  CPPUNIT_TEST(testLfuPinnedEntries);
+  CPPUNIT_TEST(testLfuCopy);
 
   CPPUNIT_TEST_SUITE_END();
 
 public:
-  CacheTest();
-  virtual ~CacheTest();
+  CacheTestClass();
+  virtual ~CacheTestClass();
   void setUp();
   void tearDown();
 
 private:
   void testAddToCache();
+  void testLruEvictionOrder();
+  void testLruPinnedEntries();
+  void testLruCopy();
+  void testLfuVictim();
+  void testLfuTieBreaking();
+  void testLfuPinnedEntries();
+  void testLfuCopy();
 
+  /**
+   * Lists the items of an LRU cache in the order in which they would be 
+   * replaced, skipping those being uploaded.
+   */
+  template <typename CacheType>
+  std::vector<int> lruOrder(const CacheType& cache) const {
+    std::vector<int> order;
+    for (auto it = cache.recencyList.begin(); it != cache.recencyList.end(); it++)
+      order.push_back(*(it->key));
+    return order;
+  }
+  /**
+   * Lists the items of an LFU cache in the order in which they would be 
+   * replaced, i.e., bucket by bucket, skipping those being uploaded.
+   */
+  template <typename CacheType>
+  std::vector<int> lfuOrder(const CacheType& cache) const {
+    std::vector<int> order;
+    for (auto bIt = cache.freqBuckets.begin(); bIt != cache.freqBuckets.end(); bIt++) {
+      for (auto it = bIt->entries.begin(); it != bIt->entries.end(); it++)
+        order.push_back(*(it->key));
+    }
+    return order;
+  }
+  /**
+   * Checks that each entry of an LFU cache is counted in a bucket of the 
+   * cache itself with its frequency, and that there are no empty buckets.
+   */
+  template <typename CacheType>
+  bool bucketsConsistent(const CacheType& cache) const {
+    unsigned int numEntries = 0;
+    for (auto bIt = cache.freqBuckets.begin(); bIt != cache.freqBuckets.end(); bIt++) {
+      if (bIt->numEntries == 0)
+        return false;
+      numEntries += bIt->numEntries;
+    }
+    for (auto it = cache.cacheMap.begin(); it != cache.cacheMap.end(); it++) {
+      bool found = false;
+      for (auto bIt = cache.freqBuckets.begin(); bIt != cache.freqBuckets.end(); bIt++) {
+        if (&(*bIt) == it->second.bucket)
+          found = true;
+      }
+      if (!found || it->second.bucket->freq != it->second.timesServed)
+        return false;
+    }
+    return numEntries == cache.cacheMap.size();
+  }
 };
 
 #endif	/* CACHETEST_HPP */